@@ -0,0 +1,56 @@
+#include <Archive.hpp>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+// Builds a synthetic archive, then times building, saving and loading it again.
+// Usage: archive_bench [entry count], 50000 if not given
+int main(int argc, char** argv){
+    std::size_t entryCount = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 50000;
+    const std::size_t filesPerFolder = 20;
+
+    auto time = [](auto&& step){
+        auto start = std::chrono::steady_clock::now();
+        step();
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    std::shared_ptr<Archive::Rarc> archive = Archive::Rarc::Create();
+    std::vector<uint8_t> fileData(64);
+
+    double buildTime = time([&](){
+        std::shared_ptr<Archive::Folder> root = Archive::Folder::Create(archive);
+        root->SetName("root");
+        archive->SetRoot(root);
+
+        // folders nest a few levels deep, each one holds a batch of small files
+        std::vector<std::shared_ptr<Archive::Folder>> folders { root };
+        std::size_t entries = 0;
+        while(entries < entryCount){
+            std::shared_ptr<Archive::Folder> folder = Archive::Folder::Create(archive);
+            folder->SetName("dir" + std::to_string(folders.size()));
+            folders[(folders.size() - 1) / 4]->AddSubdirectory(folder);
+            folders.push_back(folder);
+            entries++;
+
+            for(std::size_t i = 0; i < filesPerFolder && entries < entryCount; i++, entries++){
+                std::shared_ptr<Archive::File> file = Archive::File::Create();
+                file->SetName("file" + std::to_string(entries) + ".bin");
+                fileData[0] = entries & 0xFF;
+                file->SetData(fileData.data(), fileData.size());
+                folder->AddFile(file);
+            }
+        }
+    });
+
+    std::vector<uint8_t> saved;
+    double saveTime = time([&](){ archive->Save(saved); });
+
+    std::shared_ptr<Archive::Rarc> loaded = Archive::Rarc::Create();
+    double loadTime = time([&](){ loaded->Load(std::span<const uint8_t>(saved)); });
+
+    std::cout << entryCount << " entries, " << saved.size() << " bytes" << std::endl;
+    std::cout << "build " << buildTime << " ms, save " << saveTime << " ms, load " << loadTime << " ms" << std::endl;
+    return 0;
+}
@@ -0,0 +1,83 @@
+#include <Compression.hpp>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// Times Yaz0 and Yay0 decoding from spans on two kinds of data and prints MB/s of output.
+// Usage: decode_bench [size in MB], 16 if not given
+
+// Roughly what archive contents look like: runs of literals, zero padding, and copies both near and far back
+static std::vector<uint8_t> ArchiveLike(std::size_t size, std::mt19937& rng){
+    std::vector<uint8_t> data;
+    data.reserve(size);
+    while(data.size() < size){
+        switch(rng() % 4){
+            case 0:
+                for(std::size_t i = 0, n = 16 + rng() % 64; i < n; i++) data.push_back(rng());
+                break;
+            case 1:
+                data.insert(data.end(), 32 + rng() % 96, 0);
+                break;
+            default:
+                if(data.size() < 0x1000) break;
+                std::size_t distance = 1 + rng() % (rng() % 2 ? 0x40 : 0xFFF);
+                for(std::size_t i = 0, n = 3 + rng() % 0x60; i < n; i++) data.push_back(data[data.size() - distance]);
+                break;
+        }
+    }
+    data.resize(size);
+    return data;
+}
+
+// Text over a small alphabet, nearly every token is a short match
+static std::vector<uint8_t> ShortMatches(std::size_t size, std::mt19937& rng){
+    std::vector<uint8_t> data(size);
+    for(auto& byte : data) byte = "etaoin shrdlu"[rng() % 13];
+    return data;
+}
+
+int main(int argc, char** argv){
+    std::size_t size = (argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 16) << 20;
+    const int passes = 5;
+
+    std::mt19937 rng(1);
+    std::pair<const char*, std::vector<uint8_t>> inputs[] = {
+        { "archive-like", ArchiveLike(size, rng) },
+        { "short matches", ShortMatches(size, rng) }
+    };
+
+    for(auto& [name, data] : inputs){
+        for(Compression::Format format : { Compression::Format::YAZ0, Compression::Format::YAY0 }){
+            bStream::CMemoryStream src(data.data(), data.size(), bStream::Endianess::Big, bStream::OpenMode::In);
+            bStream::CMemoryStream dst(data.size(), bStream::Endianess::Big, bStream::OpenMode::Out);
+            if(format == Compression::Format::YAZ0){
+                Compression::Yaz0::Compress(&src, &dst, 6);
+            } else {
+                Compression::Yay0::Compress(&src, &dst, false, 6);
+            }
+
+            std::span<const uint8_t> compressed(dst.getBuffer(), dst.getSize());
+            std::vector<uint8_t> out(data.size());
+
+            // best of a few passes, the first one also checks the output
+            double best = 0;
+            for(int pass = 0; pass < passes; pass++){
+                auto start = std::chrono::steady_clock::now();
+                bool ok = format == Compression::Format::YAZ0 ? Compression::Yaz0::Decompress(compressed, out) : Compression::Yay0::Decompress(compressed, out);
+                double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+                if(!ok || (pass == 0 && out != data)){
+                    std::cout << name << ": decode failed" << std::endl;
+                    return 1;
+                }
+                best = std::max(best, data.size() / seconds / (1 << 20));
+            }
+
+            std::cout << name << " " << (format == Compression::Format::YAZ0 ? "Yaz0" : "Yay0") << ": " << best << " MB/s" << std::endl;
+        }
+    }
+    return 0;
+}
@@ -2,9 +2,13 @@
 
 #include <filesystem>
 #include <algorithm>
+#include <concepts>
 #include <memory>
+#include <string_view>
+#include <deque>
 #include <vector>
 #include <map>
+#include <unordered_map>
 #include <bstream.h>
 #include <Util.hpp>
 #include <Compression.hpp>
@@ -13,10 +17,46 @@ namespace Archive {
     class Rarc;
     class Folder;
 
-    uint16_t Hash(std::string str);
+    uint16_t Hash(std::string_view str);
+
+    enum class LoadMode {
+        Full,       // every file's data is read in while loading
+        Lazy,       // files read their data from the source on first GetData() or Materialize()
+        HeadersOnly // names, sizes and offsets only, files have no data
+    };
+
+    // Each section of a saved archive, padded the way Save lays them out
+    struct ArchiveSizes {
+        uint32_t mTotal { 0 };
+        uint32_t mDirEntries { 0 };
+        uint32_t mFileEntries { 0 };
+        uint32_t mFileData { 0 };
+        uint32_t mStrTable { 0 };
+    };
+
+    // Which files Rarc::ApplyCompressionPolicy sets a compression for
+    struct CompressionPolicy {
+        Compression::Format mFormat { Compression::Format::YAZ0 };
+        uint8_t mLevel { 9 };
+        std::size_t mMinSize { 0 };           // smaller files are left alone
+        std::vector<std::string> mExtensions; // names have to end in one of these, empty matches every name
+    };
+
+    // What lazily loaded or mapped files read from, shared by every file of the archive it was loaded from
+    class FileSource {
+    public:
+        // copies size bytes starting at offset into dst
+        virtual bool Read(std::size_t offset, uint8_t* dst, std::size_t size) = 0;
+        // sources already in memory can hand out pointers into themselves instead, nullptr otherwise
+        virtual uint8_t* View(std::size_t, std::size_t) { return nullptr; }
+        // true when every file holding the source points at the same bytes, as deduplicated files do
+        virtual bool IsSingleBuffer() { return false; }
+        virtual ~FileSource(){}
+    };
 
     class File : public std::enable_shared_from_this<File>{
         friend Rarc;
+        friend Folder;
         // this mount stays shared because the archive child should be valid for the lifetime of the file
         std::shared_ptr<Rarc> mMountedArchive;
         std::weak_ptr<Rarc> mArchive;
@@ -26,26 +66,74 @@ namespace Archive {
 
         uint8_t* mData;
         uint32_t mSize;
+        uint32_t mDataOffset;
+
+        // set until a lazily loaded file reads its data in, mSourceOffset is where it starts in the source
+        std::shared_ptr<FileSource> mSource;
+        std::size_t mSourceOffset { 0 };
+
+        // set while mData points into a mapped archive or a buffer shared with identical files instead of a buffer of its own
+        std::shared_ptr<FileSource> mMapping;
+
+        // How saves store the data, the last encode is kept along with the hash of the data it came from
+        // so saves only redo it when something changed. mEncodedFormat is None if it was stored raw.
+        // Compressed entries of loaded archives start out with only mEncoded, mData is decoded from it on demand
+        Compression::Format mCompression { Compression::Format::None };
+        uint8_t mCompressionLevel { 9 };
+        bool mEncodeValid { false };
+        Compression::Format mEncodedFormat { Compression::Format::None };
+        uint64_t mEncodedHash { 0 };
+        std::vector<uint8_t> mEncoded;
+
+        void DropEncode();
+
+        // set while the archive's decompressed data cache counts this file's data
+        bool mDecodeTracked { false };
+        bool Decode();
+        void ForgetDecode();
 
         std::shared_ptr<Rarc> GetMountedArchive(){ return mMountedArchive; }
+        std::shared_ptr<Rarc> CountingArchive();
+        void MarkModified();
 
     public:
-        void SetData(unsigned char* data, std::size_t size){
-            mSize = size;
+        void SetData(unsigned char* data, std::size_t size);
 
-            if(mData != nullptr){
-                delete[] mData;
-            }
+        const std::string& GetName() { return mName; }
+        void SetName(std::string name);
 
-            mData = new uint8_t[size];
-            memcpy(mData, data, size);
+        uint32_t GetSize() { return mSize; }
+        // Mapped files return a pointer into the mapping, writes through it are copy on write. Files sharing
+        // their data with duplicates return the shared buffer, Materialize first to edit only this one. Compressed
+        // entries are decompressed on the first call, see Rarc::SetDecompressedCacheLimit for how long that lasts
+        uint8_t* GetData() {
+            if(mSource != nullptr) Materialize();
+            if(mData == nullptr && mEncodeValid && mEncodedFormat != Compression::Format::None) Decode();
+            return mData;
         }
 
-        std::string GetName() { return mName; }
-        void SetName(std::string name) { mName = name; }
+        // The bytes and size as the archive stores them, compressed entries are left compressed. Files loaded
+        // with LoadMode::HeadersOnly have no data, their GetSize() is also the stored size
+        std::span<const uint8_t> GetRawData();
+        uint32_t GetStoredSize() { return mEncodeValid && mEncodedFormat != Compression::Format::None ? mEncoded.size() : mSize; }
 
-        uint32_t GetSize() { return mSize; }
-        uint8_t* GetData() { return mData; }
+        // Reads a lazily loaded or mapped file's data into a buffer of its own and drops its reference to
+        // the source, after this the source can go away. Returns false if the read failed
+        bool Materialize();
+        bool IsLazy() { return mSource != nullptr; }
+        bool IsMapped() { return mMapping != nullptr; }
+        // true while another file of a deduplicated load points at the same data
+        bool IsShared() { return mMapping != nullptr && mMapping->IsSingleBuffer() && mMapping.use_count() > 1; }
+
+        // Saves store this file compressed with format, each file is encoded on its own and the files of an
+        // archive are encoded in parallel. Format::Auto uses whichever of YAZ0 or YAY0 is smaller, or stores
+        // the data raw if neither is smaller than it. Size() counts compressed files at their size from the last save.
+        // Loaded compressed entries keep their format and are written back as they were until their data changes
+        void SetCompression(Compression::Format format, uint8_t level=9);
+        Compression::Format GetCompression() { return mCompression; }
+
+        // Where this file's data started in the file data chunk of the archive it was loaded from
+        uint32_t GetDataOffset() { return mDataOffset; }
 
 
         bool MountAsArchive();
@@ -65,16 +153,15 @@ namespace Archive {
         File(){
             mData = nullptr;
             mSize = 0;
+            mDataOffset = 0;
         }
 
-        ~File(){
-            if(mData != nullptr){
-                delete[] mData;
-            }
-        }
+        ~File();
     };
 
     class Folder : public std::enable_shared_from_this<Folder> {
+        friend File;
+        friend Rarc;
         std::weak_ptr<Rarc> mArchive;
         std::weak_ptr<Folder> mParentDir;
 
@@ -82,29 +169,29 @@ namespace Archive {
 
         std::vector<std::shared_ptr<Folder>> mFolders;
         std::vector<std::shared_ptr<File>> mFiles;
+        Util::NameIndex<File, Folder> mIndex;
+
+        // set once the archive's size totals include this folder, changes to it update them from then on
+        bool mCounted { false };
+
+        // position in the archive's directory list, saves write it as this folder's id
+        uint32_t mDirIndex { UINT32_MAX };
 
+        std::shared_ptr<Rarc> CountingArchive();
+        void MarkModified();
 
     public:
 
-        std::string GetName() { return mName; }
-        void SetName(std::string name) { mName = name; }
+        const std::string& GetName() { return mName; }
+        void SetName(std::string name);
 
         std::weak_ptr<Folder> GetParent() { return mParentDir.lock(); }
         void SetParent(std::shared_ptr<Folder> dir) { mParentDir = dir; dir->AddSubdirectory(shared_from_this()); } //fix this later
 
         void SetParentUnsafe(std::shared_ptr<Folder> dir){ mParentDir = dir; }
 
-        void AddFile(std::shared_ptr<File> file) { mFiles.push_back(file); }
-        void DeleteFile(std::shared_ptr<File> file) {
-            int index = -1;
-            for(int i = 0; i < mFiles.size(); i++) {
-                if(mFiles.at(i)->GetName() == file->GetName()){
-                    index = i;
-                    break;
-                }
-            }
-            if(index > -1) mFiles.erase(mFiles.begin() + index);
-        }
+        void AddFile(std::shared_ptr<File> file);
+        void DeleteFile(std::shared_ptr<File> file);
 
         void AddSubdirectory(std::shared_ptr<Folder> dir);
 
@@ -118,8 +205,15 @@ namespace Archive {
 
         std::shared_ptr<Folder> Copy(std::shared_ptr<Rarc> archive);
 
-        std::shared_ptr<File> GetFile(std::filesystem::path path);
-        std::shared_ptr<Folder> GetFolder(std::filesystem::path path);
+        // Paths are '/' separated and relative to this folder, a path that runs into a file which is
+        // an archive itself continues inside it
+        std::shared_ptr<File> GetFile(std::string_view path);
+        std::shared_ptr<Folder> GetFolder(std::string_view path);
+
+        template<std::same_as<std::filesystem::path> Path>
+        std::shared_ptr<File> GetFile(const Path& path) { return GetFile(path.generic_string()); }
+        template<std::same_as<std::filesystem::path> Path>
+        std::shared_ptr<Folder> GetFolder(const Path& path) { return GetFolder(path.generic_string()); }
 
         static std::shared_ptr<Folder> Create(std::shared_ptr<Rarc> archive){
             return std::make_shared<Folder>(archive);
@@ -151,28 +245,127 @@ namespace Archive {
     class Rarc : public std::enable_shared_from_this<Rarc> {
     private:
         friend class Folder;
+        friend class File;
         std::vector<std::shared_ptr<Folder>> mDirectories;
         bStream::Endianess mArchiveOrder { bStream::Endianess::Big };
-        std::map<std::string, uint32_t> CalculateArchiveSizes();
+
+        // Unpadded totals behind Size() for the folders in mDirectories, files and folders update them as
+        // they change. Saves recount from scratch, which also picks up edits made through GetFiles()
+        uint32_t mDirEntryBytes { 0 };
+        uint32_t mFileEntryBytes { 0 };
+        uint32_t mFileDataBytes { 0 };
+        uint32_t mStrTableBytes { 5 }; // . and ..
+        std::unordered_map<std::string, uint32_t> mNameRefs;
+
+        void AddName(const std::string& name);
+        void RemoveName(const std::string& name);
+        void CountFolder(std::shared_ptr<Folder> folder);
+
+        bool HasDirectory(const std::shared_ptr<Folder>& folder) { return folder->mDirIndex < mDirectories.size() && mDirectories[folder->mDirIndex] == folder; }
+        void AddDirectory(std::shared_ptr<Folder> folder) { folder->mDirIndex = mDirectories.size(); mDirectories.push_back(folder); }
+        void Recount();
+        ArchiveSizes CalculateArchiveSizes();
+
+        bool mDeduplicate { false };
+        uint32_t DeduplicatedDataSize();
+
+        // Fills tables with the header, fs tables and string table, and pieces with everything the archive
+        // is made of in order: tables first, then each file's own data and its padding
+        void EncodeFiles();
+
+        // Files GetData decompressed, oldest first, and how much data they hold between them
+        std::deque<std::weak_ptr<File>> mDecoded;
+        std::size_t mDecodedBytes { 0 };
+        std::size_t mDecodedLimit { 0 };
+        void TrackDecoded(std::shared_ptr<File> file);
+        void EvictDecoded(File* keep);
+        void BuildLayout(std::vector<uint8_t>& tables, std::vector<std::span<const uint8_t>>& pieces);
+        void WriteLayout(std::span<const std::span<const uint8_t>> pieces, bStream::CStream* out, Compression::Format compression, const Compression::Yaz0::CompressOptions& compressionOptions);
+
+        // With mKeepOriginal set compressed archives keep their original bytes, saves with the same format
+        // write them back as is until something changes
+        bool mModified { false };
+        bool mKeepOriginal { false };
+        std::vector<uint8_t> mOriginalData;
+        Compression::Format mOriginalFormat { Compression::Format::None };
+        bool Parse(bStream::CStream* stream, LoadMode mode, std::shared_ptr<FileSource> source);
+        // owned is null or holds data, when set its buffer is taken instead of copied if the original is kept
+        bool LoadBuffer(std::span<const uint8_t> data, LoadMode mode, std::vector<uint8_t>* owned);
+
+        // set by LoadMapped, saving over the mapped file copies mapped files out first
+        std::shared_ptr<FileSource> mMapping;
+        std::filesystem::path mMappedPath;
+        void ReleaseMapping(std::filesystem::path path);
+
+        Compression::RaceReport mLastRace;
+
+        // set by HeadersOnly loads, the files have nothing to write
+        bool mHeadersOnly { false };
 
     public:
-        bool Load(bStream::CStream* stream);
-        void Save(std::vector<uint8_t>& buffer, Compression::Format compression=Compression::Format::None, uint8_t compressionLevel=7, bool padCompressed=false);
-        void SaveToFile(std::filesystem::path path, Compression::Format compression=Compression::Format::None, uint8_t compressionLevel=7, bool padCompressed=false);
+        // HeadersOnly builds the tree with file names, sizes and offsets but no file data, compressed
+        // archives are only decoded up to the end of the fs tables. Saving these archives fails.
+        // Lazy keeps the stream, it has to stay open until every file has been materialized
+        bool Load(bStream::CStream* stream, LoadMode mode=LoadMode::Full);
+        // data may be compressed, memory streams passed to Load end up here without a copy. Lazy loads
+        // of uncompressed data read from data itself, compressed data is decoded into a buffer the files share
+        bool Load(std::span<const uint8_t> data, LoadMode mode=LoadMode::Full);
+        // Maps the file and points every file's data into the mapping, nothing is copied until SetData
+        // or Materialize. Compressed archives can't be viewed in place and are decoded like Load does
+        bool LoadMapped(std::filesystem::path path);
+        // Return false without writing anything for archives loaded with LoadMode::HeadersOnly, buffer is left empty
+        bool Save(std::vector<uint8_t>& buffer, Compression::Format compression, const Compression::Yaz0::CompressOptions& compressionOptions, bool padCompressed=false);
+        bool SaveToFile(std::filesystem::path path, Compression::Format compression, const Compression::Yaz0::CompressOptions& compressionOptions, bool padCompressed=false);
+
+        bool Save(std::vector<uint8_t>& buffer, Compression::Format compression=Compression::Format::None, uint8_t compressionLevel=7, bool padCompressed=false){
+            return Save(buffer, compression, Compression::Yaz0::CompressOptions(compressionLevel), padCompressed);
+        }
+        bool SaveToFile(std::filesystem::path path, Compression::Format compression=Compression::Format::None, uint8_t compressionLevel=7, bool padCompressed=false){
+            return SaveToFile(path, compression, Compression::Yaz0::CompressOptions(compressionLevel), padCompressed);
+        }
+
+        uint32_t Size() { return CalculateArchiveSizes().mTotal; };
 
-        uint32_t Size() { return CalculateArchiveSizes()["total"]; };
+        // Caps the memory decompressed entries take up, 0 (the default) keeps all of them. Past the cap the files
+        // decompressed longest ago free their data and decompress again on their next GetData, which leaves
+        // earlier pointers from GetData dangling. Files whose data was edited in place are never freed
+        void SetDecompressedCacheLimit(std::size_t bytes);
+
+        // Off by default. When set before loading a Yaz0 or Yay0 archive its compressed bytes are kept, and saves
+        // in the same format write them back unchanged until the archive is modified. Span loads copy the
+        // input to keep it, stream loads keep the buffer they already read it into
+        void SetKeepOriginal(bool keep) { mKeepOriginal = keep; }
+
+        // Sets the compression of every file the policy matches, other files keep theirs. Returns how many matched
+        std::size_t ApplyCompressionPolicy(const CompressionPolicy& policy);
+
+        // Sizes and timings of both encoders from the last save with Format::Auto, mWinner is the one that was written
+        const Compression::RaceReport& LastAutoCompression() { return mLastRace; }
+
+        // Off by default. Saves write identical file data once and point every entry holding it at that copy,
+        // full loads done after this give files with identical data one shared buffer. Size() has to read and
+        // hash every file while this is on
+        void SetDeduplication(bool deduplicate) { mDeduplicate = deduplicate; mModified = true; }
+        bool IsDeduplicating() { return mDeduplicate; }
 
         // Set if this should be a BE or LE rarc
-        void SetByteOrder(bStream::Endianess order) { mArchiveOrder = order; }
+        void SetByteOrder(bStream::Endianess order) { mArchiveOrder = order; mModified = true; }
+
+        // File and folder setters mark the archive modified, edits made through File::GetData have to call this
+        void MarkModified() { mModified = true; }
+        bool IsModified() { return mModified; }
         bStream::Endianess ByteOrder() { return mArchiveOrder; }
 
         // Directories should all be children of root
         std::shared_ptr<Folder> GetRoot(){ return mDirectories[0]; }
         void SetRoot(std::shared_ptr<Folder> folder) {
+            mModified = true;
             if(mDirectories.size() != 0){
                 folder->AddSubdirectory(mDirectories[0]);
             }
             mDirectories.insert(mDirectories.begin(), folder);
+            for(std::size_t i = 0; i < mDirectories.size(); i++) mDirectories[i]->mDirIndex = i;
+            CountFolder(folder);
         }
 
         template<typename T>
@@ -187,26 +380,14 @@ namespace Archive {
             return nullptr;
         }
 
-        std::shared_ptr<File> GetFile(std::filesystem::path path) {
-            if(path.begin()->string() != "/"){
-                return mDirectories[0]->GetFile(path);
-            } else {
-                std::filesystem::path subPath;
-                for(auto it = (++path.begin()); it != path.end(); it++) subPath  = subPath / it->string();
-                return mDirectories[0]->GetFile(subPath);
-            }
-        }
-
-        std::shared_ptr<Folder> GetFolder(std::filesystem::path path){
-            if(path.begin()->string() != "/"){
-                return mDirectories[0]->GetFolder(path);
-            } else {
-                std::filesystem::path subPath;
-                for(auto it = (++path.begin()); it != path.end(); it++) subPath  = subPath / it->string();
+        // Relative to root, a leading '/' is optional
+        std::shared_ptr<File> GetFile(std::string_view path) { return mDirectories[0]->GetFile(path); }
+        std::shared_ptr<Folder> GetFolder(std::string_view path) { return mDirectories[0]->GetFolder(path); }
 
-                return mDirectories[0]->GetFolder(subPath);
-            }
-        }
+        template<std::same_as<std::filesystem::path> Path>
+        std::shared_ptr<File> GetFile(const Path& path) { return GetFile(path.generic_string()); }
+        template<std::same_as<std::filesystem::path> Path>
+        std::shared_ptr<Folder> GetFolder(const Path& path) { return GetFolder(path.generic_string()); }
 
         static std::shared_ptr<Rarc> Create(){
             return std::make_shared<Rarc>();
@@ -52,6 +52,16 @@ class Bti {
 
     uint8_t* mImageData { nullptr };
 
+    // Encoded image data as loaded when mKeepOriginal is set, Save writes it back instead of encoding while the
+    // header and pixels hash the same
+    bool mKeepOriginal { false };
+    std::vector<uint8_t> mOriginalImage;
+    uint64_t mOriginalHeaderHash { 0 };
+    uint64_t mOriginalPixelHash { 0 };
+
+    uint64_t HeaderHash();
+    uint64_t PixelHash();
+
 public:
     uint16_t mWidth { 0 };
     uint16_t mHeight { 0 };
@@ -62,6 +72,9 @@ public:
     bool Load(bStream::CStream* stream);
     void Save(bStream::CStream* stream);
     void SetData(uint16_t width, uint16_t height, uint8_t* imageData);
+    // Off by default. When set before Load the encoded image is kept, and Save writes it back unchanged until
+    // the header or pixels change, the same as Rarc::SetKeepOriginal
+    void SetKeepOriginal(bool keep) { mKeepOriginal = keep; }
     void SetFormat(uint8_t fmt) { mFormat = fmt; }
 
     Bti(){}
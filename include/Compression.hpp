@@ -1,27 +1,161 @@
 #pragma once
 #include <Util.hpp>
 #include <bstream.h>
+#include <array>
+#include <chrono>
 #include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <vector>
 
 namespace Compression {
 
     enum class Format {
         None,
         YAZ0,
-        YAY0
+        YAY0,
+        Auto // whichever of YAZ0 or YAY0 is smaller, only for compressing
     };
 
+    // reads the size from the header at the start of the stream
     std::size_t GetDecompressedSize(bStream::CStream* stream);
+    std::size_t GetDecompressedSize(std::span<const uint8_t> data);
+
+    struct ProbeResult {
+        Format mFormat { Format::None };
+        std::size_t mDecompressedSize { 0 }; // for Format::None this is the size of the data
+        std::size_t mHeaderSize { 0 };
+    };
+
+    // Reads the format and sizes from the start of data, only the first 16 bytes are needed
+    ProbeResult Probe(std::span<const uint8_t> data);
+
+    // Picks the decoder from the magic, uncompressed data is copied. The span overload fills dst,
+    // which can be shorter than the decompressed size, the vector overload is resized to fit all of it
+    bool Decompress(std::span<const uint8_t> src, std::span<uint8_t> dst);
+    bool Decompress(std::span<const uint8_t> src, std::vector<uint8_t>& dst);
+
+    // Compressed outputs stored in a local directory, one file per entry named by its key. Each entry ends
+    // in its length and hash, entries that are cut short or damaged are removed instead of returned. Once the
+    // directory grows past maxSize the least recently used entries are removed until it's back to 90% of it.
+    // Safe to share between threads
+    class Cache {
+        std::filesystem::path mDirectory;
+        std::uintmax_t mMaxSize;
+        std::uintmax_t mSize { 0 };
+        std::mutex mLock;
+
+        std::filesystem::path EntryPath(uint64_t key);
+        void Evict();
+
+    public:
+        bool Get(uint64_t key, std::vector<uint8_t>& data);
+        void Put(uint64_t key, std::span<const uint8_t> data);
+
+        Cache(std::filesystem::path directory, std::uintmax_t maxSize);
+    };
+
+    // Yaz0::Compress and Yay0::Compress, and through them Rarc saves, check this cache before encoding.
+    // Keys cover the input, format and every encoder setting. nullptr turns it off, which is the default
+    void SetCache(std::shared_ptr<Cache> cache);
+    std::shared_ptr<Cache> GetCache();
 
     namespace Yaz0 {
-        // if no length provided, it will be read as if this is a full compressed file
+        // Encoder effort, the defaults are the same as level 9
+        struct CompressOptions {
+            std::size_t mSearchRange { 0x1000 };       // how far back to look for matches, at most 4 KB
+            std::size_t mMaxChainDepth { SIZE_MAX };   // how many earlier positions to try per match
+            std::size_t mNiceLength { 0x111 };         // stop looking once a match is at least this long
+            bool mLazyMatching { false };              // emit a literal instead when the next byte starts a longer match
+            bool mStoreOnly { false };                 // literals only, still a valid file but nothing is compressed
+
+            CompressOptions(){}
+            // the options each compression level maps to, levels outside 1-9 are clamped
+            explicit CompressOptions(uint8_t level);
+        };
+
+        // Decoder state between two tokens along with the 4 KB of output a back reference can reach from it
+        struct Checkpoint {
+            uint32_t mSrcPos { 16 };
+            uint32_t mDstPos { 0 };
+            uint8_t mBits { 0 };
+            uint8_t mBitCount { 0 };
+            std::array<uint8_t, 0x1000> mWindow {};
+        };
+
+        // writes bytes [offset, offset + length) of the decompressed file, if no length provided it reads to the end
         void Decompress(bStream::CStream* src_data, bStream::CStream* dst_data, uint32_t offset=0, uint32_t length=0);
+        // src is a full compressed file, fills all of dst. returns false if src runs out or is malformed
+        bool Decompress(std::span<const uint8_t> src, std::span<uint8_t> dst);
+        // fills dst with bytes [offset, offset + dst.size()), starting from the nearest checkpoint in index if there is one
+        bool Decompress(std::span<const uint8_t> src, std::span<uint8_t> dst, std::size_t offset, std::span<const Checkpoint> index={});
+        // decodes src once, recording a checkpoint about every interval bytes of output. empty if src is malformed
+        std::vector<Checkpoint> BuildIndex(std::span<const uint8_t> src, std::size_t interval=0x10000);
+        // level 1-9, scales the search window. 9 searches the whole 4 KB window
         void Compress(bStream::CStream* src_data, bStream::CStream* dst_data, uint8_t level);
+
+        // Splits the source into ranges encoded on the CompressMany threads, 0 uses every hardware thread.
+        // Output only depends on the thread count, ranges smaller than MinRangeSize are not split further
+        void Compress(bStream::CStream* src_data, bStream::CStream* dst_data, uint8_t level, uint32_t threadCount);
+        void Compress(bStream::CStream* src_data, bStream::CStream* dst_data, const CompressOptions& options, uint32_t threadCount=1);
+        constexpr std::size_t MinRangeSize = 0x10000;
+
+        // Same output as Compress, but reads the source in blocks and writes tokens as it goes so memory
+        // stays constant for any input size. The header is written at dst_data's position and patched at the end
+        void CompressStreaming(bStream::CStream* src_data, bStream::CStream* dst_data, uint8_t level);
+        void CompressStreaming(bStream::CStream* src_data, bStream::CStream* dst_data, const CompressOptions& options);
+        // src is read as one buffer made of its pieces in order, without joining them first
+        void CompressStreaming(std::span<const std::span<const uint8_t>> src, bStream::CStream* dst_data, const CompressOptions& options);
     }
 
     namespace Yay0 {
         void Decompress(bStream::CStream* src_data, bStream::CStream* dst_data, uint32_t offset=0, uint32_t length=0);
-        void Compress(bStream::CStream*  src_data, bStream::CStream* dst_data, bool padCompressedFile=false);
+        // same as Yaz0
+        bool Decompress(std::span<const uint8_t> src, std::span<uint8_t> dst);
+        // level works the same as it does for Yaz0
+        void Compress(bStream::CStream*  src_data, bStream::CStream* dst_data, bool padCompressedFile=false, uint8_t level=9);
+        void Compress(bStream::CStream*  src_data, bStream::CStream* dst_data, bool padCompressedFile, const Yaz0::CompressOptions& options);
     }
 
+    // One buffer in a batch. mSrc has to stay valid until the batch returns
+    struct Job {
+        Format mFormat { Format::YAZ0 };
+        Yaz0::CompressOptions mOptions;
+        std::span<const uint8_t> mSrc;
+
+        std::vector<uint8_t> mResult;
+        bool mSuccess { false };
+    };
+
+    // Runs every job on up to threadCount threads, 0 uses every hardware thread. The threads come from a
+    // pool shared with every other batch, so batches started from several threads or from inside a job
+    // don't add threads. Each thread takes the next unstarted job when it finishes one, so a few large
+    // jobs don't hold up the rest. Format::None copies mSrc
+    void CompressMany(std::span<Job> jobs, uint32_t threadCount=0);
+    void DecompressMany(std::span<Job> jobs, uint32_t threadCount=0);
+
+    struct RaceReport {
+        Format mWinner { Format::None };
+        std::size_t mYaz0Size { 0 };
+        std::size_t mYay0Size { 0 };
+        std::chrono::duration<double> mYaz0Time {};
+        std::chrono::duration<double> mYay0Time {};
+    };
+
+    // Encodes src as Yaz0 and Yay0 at the same time and keeps the smaller, Yaz0 wins ties. Returns the format
+    // that was kept, report gets both sizes and timings if it isn't null
+    Format CompressSmallest(std::span<const uint8_t> src, std::vector<uint8_t>& dst, const Yaz0::CompressOptions& options, RaceReport* report=nullptr);
+
+    // Predicts the compressed size of src without writing any output. Tokens are picked with chains cut to
+    // EstimateChainDepth, plus chains over longer prefixes for data with few distinct bytes. Inputs over
+    // EstimateSampleBudget only encode that many bytes in evenly spaced blocks and scale the result.
+    // Measured from 3% under to 8% over the real Yaz0 size at levels 1, 6 and 9 on text, text with zero runs,
+    // archive-like data and 2 to 6 symbol alphabets from 2 KB to 1 MB. Format::Auto gives the smaller of the two
+    std::size_t EstimateSize(std::span<const uint8_t> src, Format format, uint8_t level=9);
+    constexpr std::size_t EstimateChainDepth = 16;
+    constexpr std::size_t EstimateBlockSize = 0x800;
+    constexpr std::size_t EstimateSampleBudget = 0x8000;
+
 }
\ No newline at end of file
@@ -4,7 +4,9 @@
 #include <bstream.h>
 #include <filesystem>
 #include <Compression.hpp>
+#include <concepts>
 #include <memory>
+#include <string_view>
 #include <vector>
 #include <map>
 
@@ -21,8 +23,9 @@ namespace Disk {
 
     class File : public std::enable_shared_from_this<File>{
         friend Image;
+        friend Folder;
         std::shared_ptr<Image> mDisk;
-        std::shared_ptr<Folder> mParentDir;
+        std::weak_ptr<Folder> mParentDir;
         
         std::string mName;
         
@@ -41,8 +44,8 @@ namespace Disk {
             memcpy(mData, data, size);
         }
 
-        std::string GetName() { return mName; }
-        void SetName(std::string name) { mName = name; }
+        const std::string& GetName() { return mName; }
+        void SetName(std::string name);
 
         uint32_t GetSize() { return mSize; }
         uint8_t* GetData() { return mData; }
@@ -69,6 +72,7 @@ namespace Disk {
     };
 
     class Folder : public std::enable_shared_from_this<Folder> {
+        friend File;
         std::shared_ptr<Image> mDisk;
         std::shared_ptr<Folder> mParentDir;
 
@@ -78,17 +82,18 @@ namespace Disk {
         
         std::vector<std::shared_ptr<Folder>> mFolders;
         std::vector<std::shared_ptr<File>> mFiles;
+        Util::NameIndex<File, Folder> mIndex;
     public:
         
-        std::string GetName() { return mName; }
-        void SetName(std::string name) { mName = name; }
+        const std::string& GetName() { return mName; }
+        void SetName(std::string name);
         
         std::shared_ptr<Folder> GetParent() { return mParentDir; }
         void SetParent(std::shared_ptr<Folder> dir) { mParentDir = dir; dir->AddSubdirectory(shared_from_this()); }
 
         void SetParentUnsafe(std::shared_ptr<Folder> dir){ mParentDir = dir; }
 
-        void AddFile(std::shared_ptr<File> file) { mFiles.push_back(file); }
+        void AddFile(std::shared_ptr<File> file) { file->mParentDir = weak_from_this(); mFiles.push_back(file); mIndex.Invalidate(); }
 
         void AddSubdirectory(std::shared_ptr<Folder> dir);
 
@@ -106,8 +111,15 @@ namespace Disk {
         std::shared_ptr<Image> GetDisk() { return mDisk; }
 
         std::shared_ptr<Folder> Copy(std::shared_ptr<Image> disk);
-        std::shared_ptr<File> GetFile(std::filesystem::path path);
-        std::shared_ptr<Folder> GetFolder(std::filesystem::path path);
+
+        // Paths are '/' separated and relative to this folder
+        std::shared_ptr<File> GetFile(std::string_view path);
+        std::shared_ptr<Folder> GetFolder(std::string_view path);
+
+        template<std::same_as<std::filesystem::path> Path>
+        std::shared_ptr<File> GetFile(const Path& path) { return GetFile(path.generic_string()); }
+        template<std::same_as<std::filesystem::path> Path>
+        std::shared_ptr<Folder> GetFolder(const Path& path) { return GetFolder(path.generic_string()); }
 
         static std::shared_ptr<Folder> Create(std::shared_ptr<Image> disk){
             return std::make_shared<Folder>(disk);
@@ -182,26 +194,14 @@ namespace Disk {
             return nullptr; 
         }
 
-        std::shared_ptr<File> GetFile(std::filesystem::path path) {
-            if(path.begin()->string() != "/"){
-                return mRoot->GetFile(path);
-            } else {
-                std::filesystem::path subPath;
-                for(auto it = (++path.begin()); it != path.end(); it++) subPath  = subPath / it->string();
-                return mRoot->GetFile(subPath);
-            }
-        }
-
-        std::shared_ptr<Folder> GetFolder(std::filesystem::path path){
-            if(path.begin()->string() != "/"){
-                return mRoot->GetFolder(path);
-            } else {
-                std::filesystem::path subPath;
-                for(auto it = (++path.begin()); it != path.end(); it++) subPath  = subPath / it->string();
+        // Relative to root, a leading '/' is optional
+        std::shared_ptr<File> GetFile(std::string_view path) { return mRoot->GetFile(path); }
+        std::shared_ptr<Folder> GetFolder(std::string_view path) { return mRoot->GetFolder(path); }
 
-                return mRoot->GetFolder(subPath);
-            }
-        }
+        template<std::same_as<std::filesystem::path> Path>
+        std::shared_ptr<File> GetFile(const Path& path) { return GetFile(path.generic_string()); }
+        template<std::same_as<std::filesystem::path> Path>
+        std::shared_ptr<Folder> GetFolder(const Path& path) { return GetFolder(path.generic_string()); }
 
         static std::shared_ptr<Image> Create(){
             return std::make_shared<Image>();
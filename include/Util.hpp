@@ -1,10 +1,150 @@
 #pragma once
 
+#include <algorithm>
 #include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 
 namespace Util {
 
     uint32_t AlignTo(uint32_t x, uint32_t y);
     uint32_t PadTo32(uint32_t x);
 
+    // Fast 64 bit non cryptographic hash, for cache keys and content comparison
+    uint64_t Hash(std::span<const uint8_t> data, uint64_t seed=0);
+
+    // Takes the first name off a '/' or '\\' separated path and leaves the rest in path, empty
+    // components from leading, repeated or trailing separators are skipped. Empty once path runs out
+    std::string_view NextPathComponent(std::string_view& path);
+
+    // Position of the first file and first folder with each name among a folder's children. The index
+    // keeps its own copy of the names and of which children it was built from, adding, removing or
+    // renaming a child has to call Invalidate. Children swapped in through the vectors directly are
+    // caught when a hit no longer matches its child's name, or when a name nothing has is looked up and
+    // the children differ from the ones indexed. A swapped in child named like a child of the other
+    // kind is only found after Invalidate
+    template<typename FileType, typename FolderType>
+    class NameIndex {
+    public:
+        struct Entry {
+            int32_t mFile { -1 };
+            int32_t mFolder { -1 };
+        };
+
+    private:
+        // lets find take a string_view without building a string first
+        struct NameHash {
+            using is_transparent = void;
+            std::size_t operator()(std::string_view name) const { return std::hash<std::string_view>()(name); }
+        };
+
+        std::unordered_map<std::string, Entry, NameHash, std::equal_to<>> mEntries;
+        std::vector<const FileType*> mFiles;
+        std::vector<const FolderType*> mFolders;
+        bool mValid { false };
+        std::mutex mLock;
+
+        void Build(const std::vector<std::shared_ptr<FileType>>& files, const std::vector<std::shared_ptr<FolderType>>& folders){
+            mEntries.clear();
+            mEntries.reserve(files.size() + folders.size());
+            mFiles.clear();
+            mFolders.clear();
+
+            for(std::size_t i = 0; i < files.size(); i++){
+                Entry& entry = mEntries[files[i]->GetName()];
+                if(entry.mFile < 0) entry.mFile = i;
+                mFiles.push_back(files[i].get());
+            }
+
+            for(std::size_t i = 0; i < folders.size(); i++){
+                Entry& entry = mEntries[folders[i]->GetName()];
+                if(entry.mFolder < 0) entry.mFolder = i;
+                mFolders.push_back(folders[i].get());
+            }
+
+            mValid = true;
+        }
+
+        Entry Lookup(std::string_view name){
+            auto it = mEntries.find(name);
+            return it == mEntries.end() ? Entry() : it->second;
+        }
+
+        bool Matches(const std::vector<std::shared_ptr<FileType>>& files, const std::vector<std::shared_ptr<FolderType>>& folders){
+            return std::equal(files.begin(), files.end(), mFiles.begin(), mFiles.end(), [](auto& file, auto* indexed){ return file.get() == indexed; }) &&
+                   std::equal(folders.begin(), folders.end(), mFolders.begin(), mFolders.end(), [](auto& folder, auto* indexed){ return folder.get() == indexed; });
+        }
+
+    public:
+        Entry Find(std::string_view name, const std::vector<std::shared_ptr<FileType>>& files, const std::vector<std::shared_ptr<FolderType>>& folders){
+            std::lock_guard<std::mutex> lock(mLock);
+            if(!mValid || mFiles.size() != files.size() || mFolders.size() != folders.size()) Build(files, folders);
+
+            Entry entry = Lookup(name);
+            bool stale = (entry.mFile >= 0 && files[entry.mFile]->GetName() != name) || (entry.mFolder >= 0 && folders[entry.mFolder]->GetName() != name);
+            bool missed = entry.mFile < 0 && entry.mFolder < 0;
+            if(stale || (missed && !Matches(files, folders))){
+                Build(files, folders);
+                entry = Lookup(name);
+            }
+
+            return entry;
+        }
+
+        void Invalidate(){
+            std::lock_guard<std::mutex> lock(mLock);
+            mValid = false;
+        }
+
+        // Children pushed onto the end are added to a built index instead of making the next Find rebuild it
+        void FileAdded(const std::vector<std::shared_ptr<FileType>>& files){
+            std::lock_guard<std::mutex> lock(mLock);
+            if(!mValid || mFiles.size() + 1 != files.size()){
+                mValid = false;
+                return;
+            }
+
+            Entry& entry = mEntries[files.back()->GetName()];
+            if(entry.mFile < 0) entry.mFile = files.size() - 1;
+            mFiles.push_back(files.back().get());
+        }
+
+        void FolderAdded(const std::vector<std::shared_ptr<FolderType>>& folders){
+            std::lock_guard<std::mutex> lock(mLock);
+            if(!mValid || mFolders.size() + 1 != folders.size()){
+                mValid = false;
+                return;
+            }
+
+            Entry& entry = mEntries[folders.back()->GetName()];
+            if(entry.mFolder < 0) entry.mFolder = folders.size() - 1;
+            mFolders.push_back(folders.back().get());
+        }
+    };
+
+    // A whole file mapped into memory. Pages are copy on write, writes through GetData stay
+    // private to this mapping and never reach the file
+    class MappedFile {
+        uint8_t* mData { nullptr };
+        std::size_t mSize { 0 };
+
+    public:
+        bool Open(std::filesystem::path path);
+        void Close();
+
+        uint8_t* GetData() { return mData; }
+        std::size_t GetSize() { return mSize; }
+
+        MappedFile(){}
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+        ~MappedFile(){ Close(); }
+    };
+
 }
\ No newline at end of file
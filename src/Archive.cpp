@@ -3,11 +3,12 @@
 #include "bstream.h"
 #include <algorithm>
 #include <map>
+#include <mutex>
 #include <utility>
 
 namespace Archive {
 
-uint16_t Hash(std::string str){
+uint16_t Hash(std::string_view str){
     uint16_t hash = 0;
 
     for (std::size_t i = 0; i < str.size(); i++){
@@ -19,6 +20,104 @@ uint16_t Hash(std::string str){
     return hash;
 }
 
+// Files of archives loaded from memory, owns the buffer when it was decompressed while loading
+class _BufferSource : public FileSource {
+    std::vector<uint8_t> mOwned;
+    std::span<const uint8_t> mData;
+
+public:
+    bool Read(std::size_t offset, uint8_t* dst, std::size_t size) override {
+        if(offset > mData.size() || size > mData.size() - offset) return false;
+        std::memcpy(dst, mData.data() + offset, size);
+        return true;
+    }
+
+    std::vector<uint8_t>& Owned() { return mOwned; }
+    void SetData(std::span<const uint8_t> data) { mData = data; }
+};
+
+// Files of archives loaded from any other stream, reads are serialized since they move the stream position
+class _StreamSource : public FileSource {
+    bStream::CStream* mStream;
+    std::mutex mLock;
+
+public:
+    bool Read(std::size_t offset, uint8_t* dst, std::size_t size) override {
+        std::lock_guard<std::mutex> lock(mLock);
+        if(offset > mStream->getSize() || size > mStream->getSize() - offset) return false;
+        mStream->seek(offset);
+        mStream->readBytesTo(dst, size);
+        return true;
+    }
+
+    _StreamSource(bStream::CStream* stream) : mStream(stream) {}
+};
+
+// Files of archives opened with LoadMapped, they point straight into the mapping
+class _MappedSource : public FileSource {
+    Util::MappedFile mFile;
+
+public:
+    bool Read(std::size_t offset, uint8_t* dst, std::size_t size) override {
+        uint8_t* view = View(offset, size);
+        if(view == nullptr) return false;
+        std::memcpy(dst, view, size);
+        return true;
+    }
+
+    uint8_t* View(std::size_t offset, std::size_t size) override {
+        if(offset > mFile.GetSize() || size > mFile.GetSize() - offset) return nullptr;
+        return mFile.GetData() + offset;
+    }
+
+    Util::MappedFile& File() { return mFile; }
+};
+
+// Data of identical files that loads with deduplication on made them share, freed with the last of them
+class _SharedSource : public FileSource {
+    uint8_t* mData;
+    std::size_t mSize;
+
+public:
+    bool Read(std::size_t offset, uint8_t* dst, std::size_t size) override {
+        uint8_t* view = View(offset, size);
+        if(view == nullptr) return false;
+        std::memcpy(dst, view, size);
+        return true;
+    }
+
+    uint8_t* View(std::size_t offset, std::size_t size) override {
+        if(offset > mSize || size > mSize - offset) return nullptr;
+        return mData + offset;
+    }
+
+    bool IsSingleBuffer() override { return true; }
+
+    _SharedSource(uint8_t* data, std::size_t size) : mData(data), mSize(size) {}
+    ~_SharedSource(){ delete[] mData; }
+};
+
+// File data placed so far by a deduplicating save, looked up by content
+class _DataPool {
+    std::unordered_multimap<uint64_t, std::pair<std::span<const uint8_t>, uint32_t>> mPlaced;
+
+public:
+    // Offset of data identical to this that was placed before, otherwise data is placed at offset and that is returned
+    uint32_t Place(std::span<const uint8_t> data, uint32_t offset){
+        uint64_t hash = Util::Hash(data);
+        auto [first, last] = mPlaced.equal_range(hash);
+        for(auto placed = first; placed != last; placed++){
+            std::span<const uint8_t> other = placed->second.first;
+            if(other.size() == data.size() && (other.data() == data.data() || std::equal(other.begin(), other.end(), data.begin()))){
+                return placed->second.second;
+            }
+        }
+
+        mPlaced.insert({ hash, { data, offset } });
+        return offset;
+    }
+};
+
 ///
 /// Folder
 ///
@@ -27,51 +126,82 @@ Folder::Folder(std::shared_ptr<Rarc> archive){
     mArchive = archive;
 }
 
-std::shared_ptr<File> Folder::GetFile(std::filesystem::path path) {
-    if(path.begin() == path.end()) return nullptr;
+void Folder::SetName(std::string name){
+    if(std::shared_ptr<Rarc> archive = CountingArchive()){
+        archive->RemoveName(mName);
+        archive->AddName(name);
+    }
 
+    mName = name;
+    if(std::shared_ptr<Folder> parent = mParentDir.lock()){
+        parent->mIndex.Invalidate();
+    }
+    MarkModified();
+}
 
-    for(auto file : mFiles){
-        if(file->GetName() == path.begin()->string()){
-            if(((++path.begin()) == path.end())){
-                return file;
-            } else {
-                if(file->MountAsArchive()){
-                    std::filesystem::path subPath;
-                    for(auto it = (++path.begin()); it != path.end(); it++) subPath  = subPath / it->string();
-                    return (*file)->GetFile(subPath);
-                }
-            }
-        }
+void Folder::AddFile(std::shared_ptr<File> file) {
+    file->mArchive = mArchive;
+    file->mParentDir = weak_from_this();
+    mFiles.push_back(file);
+    mIndex.FileAdded(mFiles);
+
+    if(std::shared_ptr<Rarc> archive = CountingArchive()){
+        archive->mFileEntryBytes += 0x14;
+        archive->mFileDataBytes += Util::PadTo32(file->GetStoredSize());
+        archive->AddName(file->mName);
     }
 
-    std::shared_ptr<File> file = nullptr;
+    MarkModified();
+}
 
-    for(auto dir : mFolders){
-        if(dir->GetName() == path.begin()->string()){
-            std::filesystem::path subPath;
-            for(auto it = (++path.begin()); it != path.end(); it++) subPath  = subPath / it->string();
-            file = dir->GetFile(subPath);
+void Folder::DeleteFile(std::shared_ptr<File> file) {
+    int32_t index = mIndex.Find(file->GetName(), mFiles, mFolders).mFile;
+    if(index > -1){
+        if(std::shared_ptr<Rarc> archive = CountingArchive()){
+            archive->mFileEntryBytes -= 0x14;
+            archive->mFileDataBytes -= Util::PadTo32(mFiles[index]->GetStoredSize());
+            archive->RemoveName(mFiles[index]->mName);
         }
-    }
 
-    return file;
+        mFiles[index]->mParentDir.reset();
+        mFiles.erase(mFiles.begin() + index);
+        mIndex.Invalidate();
+        MarkModified();
+    }
 }
 
-std::shared_ptr<Folder> Folder::GetFolder(std::filesystem::path path){
-    for(auto dir : mFolders){
-        if(dir->GetName() == path.begin()->string() && ((++path.begin()) == path.end())){
-            return dir;
-        } else if(dir->GetName() == path.begin()->string()) {
-            std::filesystem::path subPath;
-            for(auto it = (++path.begin()); it != path.end(); it++) subPath  = subPath / it->string();
-            return dir->GetFolder(subPath);
+std::shared_ptr<File> Folder::GetFile(std::string_view path) {
+    std::string_view name = Util::NextPathComponent(path);
+    if(name.empty()) return nullptr;
+
+    Util::NameIndex<File, Folder>::Entry entry = mIndex.Find(name, mFiles, mFolders);
+
+    if(entry.mFile >= 0){
+        std::shared_ptr<File>& file = mFiles[entry.mFile];
+        if(path.empty()){
+            return file;
+        } else if(file->mMountedArchive != nullptr || file->MountAsArchive()){
+            return (*file)->GetFile(path);
         }
     }
 
+    if(entry.mFolder >= 0){
+        return mFolders[entry.mFolder]->GetFile(path);
+    }
+
     return nullptr;
 }
 
+std::shared_ptr<Folder> Folder::GetFolder(std::string_view path){
+    std::string_view name = Util::NextPathComponent(path);
+    if(name.empty()) return nullptr;
+
+    int32_t index = mIndex.Find(name, mFiles, mFolders).mFolder;
+    if(index < 0) return nullptr;
+
+    return path.empty() ? mFolders[index] : mFolders[index]->GetFolder(path);
+}
+
 std::shared_ptr<Folder> Folder::Copy(std::shared_ptr<Rarc> archive){
     std::shared_ptr<Folder> newFolder = Folder::Create(archive);
     newFolder->SetName(mName);
@@ -85,17 +215,35 @@ std::shared_ptr<Folder> Folder::Copy(std::shared_ptr<Rarc> archive){
     return newFolder;
 }
 
+std::shared_ptr<Rarc> Folder::CountingArchive(){
+    return mCounted ? mArchive.lock() : nullptr;
+}
+
+void Folder::MarkModified(){
+    if(std::shared_ptr<Rarc> archive = mArchive.lock()){
+        archive->MarkModified();
+    }
+}
+
 void Folder::AddSubdirectory(std::shared_ptr<Folder> dir){
+    MarkModified();
+
     if(dir->GetArchive().lock() != mArchive.lock()){
         std::shared_ptr<Folder> copy = dir->Copy(mArchive.lock());
         AddSubdirectory(copy);
     } else {
         dir->SetParentUnsafe(GetPtr());
         mFolders.push_back(dir);
+        mIndex.FolderAdded(mFolders);
+
+        if(std::shared_ptr<Rarc> archive = CountingArchive()){
+            archive->mFileEntryBytes += 0x14;
+        }
 
-        auto dirIter = std::find(mArchive.lock()->mDirectories.begin(), mArchive.lock()->mDirectories.end(), dir);
-        if(dirIter == mArchive.lock()->mDirectories.end()){
-            mArchive.lock()->mDirectories.push_back(dir);
+        std::shared_ptr<Rarc> archive = mArchive.lock();
+        if(!archive->HasDirectory(dir)){
+            archive->AddDirectory(dir);
+            archive->CountFolder(dir);
         }
     }
 }
@@ -104,13 +252,146 @@ void Folder::AddSubdirectory(std::shared_ptr<Folder> dir){
 /// File
 ///
 
+File::~File(){
+    ForgetDecode();
+    if(mData != nullptr && mMapping == nullptr){
+        delete[] mData;
+    }
+}
+
+void File::SetData(unsigned char* data, std::size_t size){
+    MarkModified();
+    if(std::shared_ptr<Rarc> archive = CountingArchive()){
+        archive->mFileDataBytes += Util::PadTo32(size) - Util::PadTo32(GetStoredSize());
+    }
+
+    ForgetDecode();
+
+    mSize = size;
+    mEncodeValid = false;
+    mEncoded = {};
+    mSource = nullptr;
+    mMountedArchive = nullptr;
+
+    if(mData != nullptr && mMapping == nullptr){
+        delete[] mData;
+    }
+    mMapping = nullptr;
+
+    mData = new uint8_t[size];
+    memcpy(mData, data, size);
+}
+
+void File::SetCompression(Compression::Format format, uint8_t level){
+    if(format == mCompression && level == mCompressionLevel) return;
+
+    mCompression = format;
+    mCompressionLevel = level;
+    DropEncode();
+    MarkModified();
+}
+
+void File::DropEncode(){
+    // a compressed entry that was never decompressed has no other copy of its data
+    if(mData == nullptr && mEncodeValid && mEncodedFormat != Compression::Format::None) Decode();
+    ForgetDecode();
+
+    if(std::shared_ptr<Rarc> archive = CountingArchive()){
+        archive->mFileDataBytes += Util::PadTo32(mSize) - Util::PadTo32(GetStoredSize());
+    }
+
+    mEncodeValid = false;
+    mEncoded = {};
+}
+
+std::span<const uint8_t> File::GetRawData(){
+    if(mEncodeValid && mEncodedFormat != Compression::Format::None){
+        return mEncoded;
+    }
+    return std::span<const uint8_t>(GetData(), mSize);
+}
+
+bool File::Decode(){
+    uint8_t* data = new uint8_t[mSize];
+    if(!Compression::Decompress(mEncoded, std::span<uint8_t>(data, mSize))){
+        delete[] data;
+        return false;
+    }
+
+    // saves and the cache compare against this to tell if the data was edited in place
+    mData = data;
+    mEncodedHash = Util::Hash(std::span<const uint8_t>(mData, mSize));
+
+    if(std::shared_ptr<Rarc> archive = mArchive.lock()){
+        archive->TrackDecoded(GetPtr());
+    }
+    return true;
+}
+
+void File::ForgetDecode(){
+    if(!mDecodeTracked) return;
+    mDecodeTracked = false;
+
+    if(std::shared_ptr<Rarc> archive = mArchive.lock()){
+        archive->mDecodedBytes -= mSize;
+    }
+}
+
+void File::SetName(std::string name){
+    if(std::shared_ptr<Rarc> archive = CountingArchive()){
+        archive->RemoveName(mName);
+        archive->AddName(name);
+    }
+
+    mName = name;
+    if(std::shared_ptr<Folder> parent = mParentDir.lock()){
+        parent->mIndex.Invalidate();
+    }
+    MarkModified();
+}
+
+// The archive whose size totals include this file, null until its folder is part of one
+std::shared_ptr<Rarc> File::CountingArchive(){
+    std::shared_ptr<Folder> parent = mParentDir.lock();
+    return parent != nullptr ? parent->CountingArchive() : nullptr;
+}
+
+void File::MarkModified(){
+    if(std::shared_ptr<Rarc> archive = mArchive.lock()){
+        archive->MarkModified();
+    }
+}
+
+bool File::Materialize(){
+    if(mMapping != nullptr){
+        uint8_t* data = new uint8_t[mSize];
+        std::memcpy(data, mData, mSize);
+        mData = data;
+        mMapping = nullptr;
+        return true;
+    }
+
+    if(mSource == nullptr) return true;
+
+    uint8_t* data = new uint8_t[mSize];
+    if(!mSource->Read(mSourceOffset, data, mSize)){
+        delete[] data;
+        return false;
+    }
+
+    if(mData != nullptr){
+        delete[] mData;
+    }
+
+    mData = data;
+    mSource = nullptr;
+    return true;
+}
+
 bool File::MountAsArchive(){
     std::shared_ptr<Rarc> arc =  Rarc::Create();
 
-    // There needs to be some way to specify endian here, maybe check magic and load it smart?
-    bStream::CMemoryStream stream(mData, mSize, bStream::Endianess::Big, bStream::OpenMode::In);
-
-    if(arc->Load(&stream)){
+    if(arc->Load(std::span<const uint8_t>(GetData(), mSize))){
         mMountedArchive = arc;
         return true;
     } else {
@@ -125,71 +406,219 @@ bool File::MountAsArchive(){
 /// Archive
 ///
 
-std::map<std::string, uint32_t> Rarc::CalculateArchiveSizes(){
-    uint32_t size = 0x40;
+// The string table only holds each name once, names are counted in when their first user shows up
+void Rarc::AddName(const std::string& name){
+    if(mNameRefs[name]++ == 0){
+        mStrTableBytes += name.size() + 1;
+    }
+}
 
-    std::map<std::string, bool> isUniqueStr;
+void Rarc::RemoveName(const std::string& name){
+    auto ref = mNameRefs.find(name);
+    if(ref != mNameRefs.end() && --ref->second == 0){
+        mStrTableBytes -= name.size() + 1;
+        mNameRefs.erase(ref);
+    }
+}
 
-    uint32_t dirEntrySize = 0x00; //??
-    uint32_t fileEntrySize = 0;
-    uint32_t fileDataSize = 0;
-    uint32_t strTableSize = 5; // Accounts for .\0 and ..\0 strs
+void Rarc::CountFolder(std::shared_ptr<Folder> folder){
+    if(folder->mCounted) return;
+    folder->mCounted = true;
+
+    mDirEntryBytes += 0x10;
+    AddName(folder->mName);
+
+    mFileEntryBytes += 0x14 + 0x14; // . and .. entries
+    mFileEntryBytes += 0x14 * folder->mFolders.size();
+
+    for(auto& file : folder->mFiles){
+        mFileEntryBytes += 0x14;
+        mFileDataBytes += Util::PadTo32(file->GetStoredSize());
+        AddName(file->mName);
+    }
+}
+
+void Rarc::Recount(){
+    mDirEntryBytes = 0;
+    mFileEntryBytes = 0;
+    mFileDataBytes = 0;
+    mStrTableBytes = 5;
+    mNameRefs.clear();
+
+    for(auto& dir : mDirectories) dir->mCounted = false;
+    for(auto& dir : mDirectories) CountFolder(dir);
+}
 
+ArchiveSizes Rarc::CalculateArchiveSizes(){
+    ArchiveSizes sizes;
+    sizes.mDirEntries = Util::PadTo32(mDirEntryBytes);
+    sizes.mFileEntries = Util::PadTo32(mFileEntryBytes);
+    sizes.mFileData = mDeduplicate ? DeduplicatedDataSize() : mFileDataBytes;
+    sizes.mStrTable = Util::PadTo32(mStrTableBytes);
+    sizes.mTotal = Util::PadTo32(0x40 + sizes.mDirEntries + sizes.mFileEntries + sizes.mFileData + sizes.mStrTable);
+    return sizes;
+}
+
+
+void Rarc::ReleaseMapping(std::filesystem::path path){
+    std::error_code error;
+    if(mMapping == nullptr || !std::filesystem::equivalent(path, mMappedPath, error)) return;
+
+    // Rewriting the file would change or cut off pages the files still point at
     for(auto dir : mDirectories){
-        dirEntrySize += 0x10;
+        for(auto file : dir->GetFiles()){
+            if(file->mMapping == mMapping) file->Materialize();
+        }
+    }
+
+    mMapping = nullptr;
+}
+
+std::size_t Rarc::ApplyCompressionPolicy(const CompressionPolicy& policy){
+    std::size_t matched = 0;
+    for(auto& dir : mDirectories){
+        for(auto& file : dir->GetFiles()){
+            if(file->GetSize() < policy.mMinSize) continue;
+
+            bool extensionMatches = policy.mExtensions.empty() || std::any_of(policy.mExtensions.begin(), policy.mExtensions.end(), [&](const std::string& extension){
+                return file->GetName().ends_with(extension);
+            });
+            if(!extensionMatches) continue;
 
-        if(isUniqueStr.count(dir->GetName()) == 0){
-            strTableSize += dir->GetName().size() + 1;
-            isUniqueStr.insert({dir->GetName(), true});
+            file->SetCompression(policy.mFormat, policy.mLevel);
+            matched++;
         }
+    }
+    return matched;
+}
+
+// Same walk BuildLayout does, files without data (HeadersOnly loads) are counted in full
+uint32_t Rarc::DeduplicatedDataSize(){
+    _DataPool pool;
+    uint32_t size = 0;
+    for(auto& dir : mDirectories){
+        for(auto& file : dir->GetFiles()){
+            std::span<const uint8_t> data = file->GetRawData();
+            if(data.data() == nullptr || pool.Place(data, size) == size){
+                size += Util::PadTo32(file->GetStoredSize());
+            }
+        }
+    }
+    return size;
+}
 
-        fileEntrySize += 0x14 + 0x14; // . and .. entries
+void Rarc::SetDecompressedCacheLimit(std::size_t bytes){
+    mDecodedLimit = bytes;
+    EvictDecoded(nullptr);
+}
+
+void Rarc::TrackDecoded(std::shared_ptr<File> file){
+    file->mDecodeTracked = true;
+    mDecoded.push_back(file);
+    mDecodedBytes += file->mSize;
+    EvictDecoded(file.get());
+}
 
-        for(auto subdir : dir->GetSubdirectories()){
-            fileEntrySize += 0x14;
+// Frees the oldest decompressed data until the cache fits its limit again, keep was just decompressed
+// and stays. Entries of files that were freed or edited since are stale and skipped
+void Rarc::EvictDecoded(File* keep){
+    std::size_t remaining = keep != nullptr ? mDecoded.size() - 1 : mDecoded.size();
+    for(; remaining > 0 && mDecodedLimit != 0 && mDecodedBytes > mDecodedLimit; remaining--){
+        std::shared_ptr<File> file = mDecoded.front().lock();
+        mDecoded.pop_front();
+        if(file == nullptr || !file->mDecodeTracked || file.get() == keep) continue;
+
+        // edited in place, the data is the only copy of those edits now
+        bool unchanged = Util::Hash(std::span<const uint8_t>(file->mData, file->mSize)) == file->mEncodedHash;
+        file->ForgetDecode();
+        if(unchanged){
+            delete[] file->mData;
+            file->mData = nullptr;
         }
+    }
+}
 
-        for(auto file : dir->GetFiles()){
-            if(isUniqueStr.count(file->GetName()) == 0){
-                strTableSize += file->GetName().size() + 1;
-                isUniqueStr.insert({file->GetName(), true});
+// Encodes every compressed file whose data changed since its last encode, as one Compression::CompressMany batch
+void Rarc::EncodeFiles(){
+    std::vector<std::shared_ptr<File>> files;
+    std::vector<uint64_t> hashes;
+    std::vector<Compression::Job> jobs;
+
+    for(auto& dir : mDirectories){
+        for(auto& file : dir->GetFiles()){
+            if(file->mCompression == Compression::Format::None){
+                if(file->mEncodeValid) file->DropEncode();
+                continue;
             }
 
-            fileEntrySize += 0x14;
-            fileDataSize += Util::PadTo32(file->GetSize());
+            // never decompressed, so it can't have changed
+            if(file->mEncodeValid && file->mData == nullptr) continue;
+
+            std::span<const uint8_t> data(file->GetData(), file->GetSize());
+            uint64_t hash = Util::Hash(data);
+            if(file->mEncodeValid && file->mEncodedHash == hash) continue;
+
+            files.push_back(file);
+            hashes.push_back(hash);
+            Compression::Job& job = jobs.emplace_back();
+            job.mFormat = file->mCompression;
+            job.mOptions = Compression::Yaz0::CompressOptions(file->mCompressionLevel);
+            job.mSrc = data;
         }
     }
 
-    size += Util::PadTo32(dirEntrySize) + Util::PadTo32(fileEntrySize) + fileDataSize + Util::PadTo32(strTableSize);
+    Compression::CompressMany(jobs);
 
-    return {{"total", Util::PadTo32(size)}, {"dirEntries", Util::PadTo32(dirEntrySize)}, {"fileEntries", Util::PadTo32(fileEntrySize)}, {"fileData", fileDataSize}, {"strTable", Util::PadTo32(strTableSize)}};
+    for(std::size_t i = 0; i < jobs.size(); i++){
+        std::shared_ptr<File> file = files[i];
+        file->mEncodedFormat = Compression::Probe(jobs[i].mResult).mFormat;
+        file->mEncoded = std::move(jobs[i].mResult);
+        if(file->mCompression == Compression::Format::Auto && file->mEncoded.size() >= file->mSize){
+            file->mEncodedFormat = Compression::Format::None;
+            file->mEncoded = {};
+        }
+        file->mEncodedHash = hashes[i];
+        file->mEncodeValid = true;
+    }
 }
 
+// Zeroes the padding pieces point at, files are padded to 32 bytes so no run is longer than this
+static const uint8_t PaddingBytes[0x20] = {};
 
-void Rarc::SaveToFile(std::filesystem::path path, Compression::Format compression, uint8_t compressionLevel, bool padCompressed){
-
-    std::map<std::string, uint32_t> archiveSizes = CalculateArchiveSizes();
+void Rarc::BuildLayout(std::vector<uint8_t>& tables, std::vector<std::span<const uint8_t>>& pieces){
+    EncodeFiles();
+    Recount();
 
+    // file data isn't needed here, which saves the deduplicating pass CalculateArchiveSizes would do
+    ArchiveSizes archiveSizes;
+    archiveSizes.mDirEntries = Util::PadTo32(mDirEntryBytes);
+    archiveSizes.mFileEntries = Util::PadTo32(mFileEntryBytes);
+    archiveSizes.mStrTable = Util::PadTo32(mStrTableBytes);
 
-    uint8_t* archiveData = new uint8_t[archiveSizes["total"]];
-    memset(archiveData, 0, archiveSizes["total"]);
+    std::size_t tablesSize = 0x40 + archiveSizes.mDirEntries + archiveSizes.mFileEntries + archiveSizes.mStrTable;
+    tables.assign(tablesSize, 0);
 
-    uint8_t* fileSystemChunk = archiveData + 0x20;
-    uint8_t* dirChunk = archiveData + 0x40;
-    uint8_t* fileChunk = archiveData + 0x40 + archiveSizes["dirEntries"];
-    uint8_t* strTableChunk = archiveData + 0x40 + archiveSizes["dirEntries"] + archiveSizes["fileEntries"];
-    uint8_t* fileDataChunk = archiveData + 0x40 + archiveSizes["dirEntries"] + archiveSizes["fileEntries"] + archiveSizes["strTable"];
+    uint8_t* fileSystemChunk = tables.data() + 0x20;
+    uint8_t* dirChunk = tables.data() + 0x40;
+    uint8_t* fileChunk = tables.data() + 0x40 + archiveSizes.mDirEntries;
+    uint8_t* strTableChunk = tables.data() + 0x40 + archiveSizes.mDirEntries + archiveSizes.mFileEntries;
+    std::size_t fileDataOffset = tablesSize; // where the file data chunk starts in the archive
 
-    bStream::CMemoryStream headerStream(archiveData, 0x20, mArchiveOrder, bStream::OpenMode::Out);
+    bStream::CMemoryStream headerStream(tables.data(), 0x20, mArchiveOrder, bStream::OpenMode::Out);
     bStream::CMemoryStream fileSystemStream(fileSystemChunk, 0x20, mArchiveOrder, bStream::OpenMode::Out);
-    bStream::CMemoryStream dirStream(dirChunk, archiveSizes["dirEntries"], mArchiveOrder, bStream::OpenMode::Out);
-    bStream::CMemoryStream fileStream(fileChunk, archiveSizes["fileEntries"], mArchiveOrder, bStream::OpenMode::Out);
-    bStream::CMemoryStream stringTableStream(strTableChunk, archiveSizes["strTable"], mArchiveOrder, bStream::OpenMode::Out);
-    bStream::CMemoryStream fileDataStream(fileDataChunk, archiveSizes["fileData"], mArchiveOrder, bStream::OpenMode::Out);
+    bStream::CMemoryStream dirStream(dirChunk, archiveSizes.mDirEntries, mArchiveOrder, bStream::OpenMode::Out);
+    bStream::CMemoryStream fileStream(fileChunk, archiveSizes.mFileEntries, mArchiveOrder, bStream::OpenMode::Out);
+    bStream::CMemoryStream stringTableStream(strTableChunk, archiveSizes.mStrTable, mArchiveOrder, bStream::OpenMode::Out);
+
+    pieces.clear();
+    pieces.push_back(tables);
 
     // Generate String Table
 
-    std::map<std::string, uint32_t> stringTable{{".", 0x00}, {"..", 0x02}};
+    // Keys view the names of the folders and files, which outlive the save
+    std::unordered_map<std::string_view, uint32_t> stringTable;
+    stringTable.reserve(mNameRefs.size() + 2);
+    stringTable.insert({{".", 0x00}, {"..", 0x02}});
 
     stringTableStream.writeString(".");
     stringTableStream.writeUInt8(0x00);
@@ -197,14 +626,12 @@ void Rarc::SaveToFile(std::filesystem::path path, Compression::Format compressio
     stringTableStream.writeUInt8(0x00);
 
     for(auto dir : mDirectories){
-        if(stringTable.count(dir->GetName()) == 0){
-            stringTable.insert({dir->GetName(), stringTableStream.tell()});
+        if(stringTable.try_emplace(dir->GetName(), stringTableStream.tell()).second){
             stringTableStream.writeString(dir->GetName());
             stringTableStream.writeUInt8(0x00);
         }
         for(auto file : dir->GetFiles()){
-            if(stringTable.count(file->GetName()) == 0){
-                stringTable.insert({file->GetName(), stringTableStream.tell()});
+            if(stringTable.try_emplace(file->GetName(), stringTableStream.tell()).second){
                 stringTableStream.writeString(file->GetName());
                 stringTableStream.writeUInt8(0x00);
             }
@@ -212,13 +639,15 @@ void Rarc::SaveToFile(std::filesystem::path path, Compression::Format compressio
     }
 
     std::size_t currentFileIndex = 0;
+    uint32_t fileDataSize = 0;
+    _DataPool dataPool;
 
     // Write Archive Structure
     for(std::size_t i = 0; i < mDirectories.size(); i++)
     {
         std::shared_ptr<Folder> folder = mDirectories[i];
 
-        std::string folderName = folder->GetName();
+        const std::string& folderName = folder->GetName();
 
         //Write IDs
         if(i == 0){
@@ -248,39 +677,47 @@ void Rarc::SaveToFile(std::filesystem::path path, Compression::Format compressio
 
         // Write File entries
         for(auto file : folder->GetFiles()){
+            // 0x04 marks compressed data, 0x80 along with it means Yaz0 rather than Yay0
+            bool encoded = file->mEncodeValid && file->mEncodedFormat != Compression::Format::None;
+            uint8_t attrs = 0x01 | 0x10;
+            if(encoded) attrs |= 0x04 | (file->mEncodedFormat == Compression::Format::YAZ0 ? 0x80 : 0x00);
+
+            // The data itself is left where it is, the writer reads it from the file
+            std::span<const uint8_t> data = encoded ? std::span<const uint8_t>(file->mEncoded) : std::span<const uint8_t>(file->GetData(), file->GetSize());
+
             fileStream.writeUInt16(currentFileIndex);
             fileStream.writeUInt16(Hash(file->GetName()));
-            fileStream.writeUInt8(0x01 | 0x10);
+            fileStream.writeUInt8(attrs);
             fileStream.writeUInt8(0x00);
 
-            std::string fileName = file->GetName();
-            fileStream.writeUInt16(stringTable[fileName]);
-            fileStream.writeUInt32(fileDataStream.tell());
-            fileStream.writeUInt32(file->GetSize());
+            // duplicates point at the first copy and add nothing to the data chunk
+            uint32_t dataOffset = mDeduplicate ? dataPool.Place(data, fileDataSize) : fileDataSize;
+
+            fileStream.writeUInt16(stringTable[file->GetName()]);
+            fileStream.writeUInt32(dataOffset);
+            fileStream.writeUInt32(data.size());
             fileStream.writeUInt32(0x00);
 
-            fileDataStream.writeBytes(file->GetData(), file->GetSize());
+            if(dataOffset == fileDataSize){
+                pieces.push_back(data);
 
-            uint32_t delta = Util::PadTo32(file->GetSize()) - file->GetSize();
-            for(int x = 0; x < delta; x++){
-                fileDataStream.writeUInt8(0);
-            }
+                uint32_t delta = Util::PadTo32(data.size()) - data.size();
+                if(delta > 0) pieces.push_back(std::span<const uint8_t>(PaddingBytes, delta));
 
+                fileDataSize += Util::PadTo32(data.size());
+            }
             currentFileIndex++;
         }
 
         // Write Subdirectory entries
         for(auto subdir : folder->GetSubdirectories()){
-            auto subdirIter = std::find(mDirectories.begin(), mDirectories.end(), subdir);
             fileStream.writeUInt16(0xFFFF);
             fileStream.writeUInt16(Hash(subdir->GetName()));
             fileStream.writeUInt8(0x02);
             fileStream.writeUInt8(0x00);
 
-            std::string subdirName = subdir->GetName();
-
-            fileStream.writeUInt16(stringTable[subdirName]); // ????
-            fileStream.writeUInt32(subdirIter - mDirectories.begin());
+            fileStream.writeUInt16(stringTable[subdir->GetName()]); // ????
+            fileStream.writeUInt32(subdir->mDirIndex);
             fileStream.writeUInt32(0x10);
             fileStream.writeUInt32(0x00);
             currentFileIndex++;
@@ -304,9 +741,8 @@ void Rarc::SaveToFile(std::filesystem::path path, Compression::Format compressio
         fileStream.writeUInt8(0x02);
         fileStream.writeUInt8(0x00);
         fileStream.writeUInt16(0x02);
-        if(folder->GetParent().lock() != nullptr){
-            auto dirIter = std::find(mDirectories.begin(), mDirectories.end(), folder->GetParent().lock());
-            fileStream.writeUInt32(dirIter - mDirectories.begin());
+        if(std::shared_ptr<Folder> parent = folder->GetParent().lock()){
+            fileStream.writeUInt32(parent->mDirIndex);
         } else {
             fileStream.writeUInt32((uint32_t)-1);
         }
@@ -318,11 +754,11 @@ void Rarc::SaveToFile(std::filesystem::path path, Compression::Format compressio
 
     // Write Header
     headerStream.writeUInt32(0x52415243);
-    headerStream.writeUInt32(archiveSizes["total"]);
-    headerStream.writeUInt32(fileSystemChunk - archiveData);
-    headerStream.writeUInt32(fileDataChunk - fileSystemChunk);
-    headerStream.writeUInt32(fileDataStream.getSize());
-    headerStream.writeUInt32(fileDataStream.getSize()); //TODO: mram flag!
+    headerStream.writeUInt32(tablesSize + fileDataSize);
+    headerStream.writeUInt32(fileSystemChunk - tables.data());
+    headerStream.writeUInt32(fileDataOffset - (fileSystemChunk - tables.data()));
+    headerStream.writeUInt32(fileDataSize);
+    headerStream.writeUInt32(fileDataSize); //TODO: mram flag!
     headerStream.writeUInt32(0); //TODO: aram flag!
     headerStream.writeUInt32(0); // pad
 
@@ -337,273 +773,215 @@ void Rarc::SaveToFile(std::filesystem::path path, Compression::Format compressio
     fileSystemStream.writeUInt8(0);
     fileSystemStream.writeUInt8(0);
     fileSystemStream.writeUInt32(0);
+}
+
+void Rarc::WriteLayout(std::span<const std::span<const uint8_t>> pieces, bStream::CStream* out, Compression::Format compression, const Compression::Yaz0::CompressOptions& compressionOptions){
+    // Yaz0 is encoded straight from the pieces, the other encoders and the cache need the archive in one buffer
+    auto gather = [pieces](){
+        std::vector<uint8_t> archiveData;
+        for(auto piece : pieces) archiveData.insert(archiveData.end(), piece.begin(), piece.end());
+        return archiveData;
+    };
 
     switch(compression){
         case Compression::Format::None:
-            {
-                bStream::CFileStream outFile(path.string(), mArchiveOrder, bStream::OpenMode::Out);
-                outFile.writeBytes(archiveData, archiveSizes["total"]);
-                if(padCompressed) while(outFile.tell() < Util::AlignTo(outFile.getSize(), 0x20)) { outFile.writeUInt8(0); }
-            }
+            for(auto piece : pieces) out->writeBytes(piece.data(), piece.size());
             break;
 
         // Compresison container, as far as I can tell, is always BE
+        case Compression::Format::YAZ0:
+            if(Compression::GetCache() == nullptr){
+                Compression::Yaz0::CompressStreaming(pieces, out, compressionOptions);
+            } else {
+                std::vector<uint8_t> archiveData = gather();
+                bStream::CMemoryStream archiveIn(archiveData.data(), archiveData.size(), bStream::Endianess::Big, bStream::OpenMode::In);
+                Compression::Yaz0::Compress(&archiveIn, out, compressionOptions);
+            }
+            break;
         case Compression::Format::YAY0:
             {
-                bStream::CMemoryStream archiveOut(archiveData, archiveSizes["total"], bStream::Endianess::Big, bStream::OpenMode::In);
-                bStream::CFileStream outFile(path.string(), bStream::Endianess::Big, bStream::OpenMode::Out);
-
-                Compression::Yay0::Compress(&archiveOut, &outFile);
-                if(padCompressed) while(outFile.tell() < Util::AlignTo(outFile.getSize(), 0x20)) { outFile.writeUInt8(0); }
+                std::vector<uint8_t> archiveData = gather();
+                bStream::CMemoryStream archiveIn(archiveData.data(), archiveData.size(), bStream::Endianess::Big, bStream::OpenMode::In);
+                Compression::Yay0::Compress(&archiveIn, out, false, compressionOptions);
             }
             break;
-        case Compression::Format::YAZ0:
+        case Compression::Format::Auto:
             {
-                bStream::CMemoryStream archiveOut(archiveData, archiveSizes["total"], bStream::Endianess::Big, bStream::OpenMode::In);
-                bStream::CFileStream outFile(path.string(), bStream::Endianess::Big, bStream::OpenMode::Out);
-
-                Compression::Yaz0::Compress(&archiveOut, &outFile, compressionLevel);
-                if(padCompressed) while(outFile.tell() < Util::AlignTo(outFile.getSize(), 0x20)) { outFile.writeUInt8(0); }
+                std::vector<uint8_t> compressed;
+                Compression::CompressSmallest(gather(), compressed, compressionOptions, &mLastRace);
+                out->writeBytes(compressed.data(), compressed.size());
             }
             break;
     }
+}
 
+bool Rarc::SaveToFile(std::filesystem::path path, Compression::Format compression, const Compression::Yaz0::CompressOptions& compressionOptions, bool padCompressed){
+    if(mHeadersOnly) return false;
 
-    delete[] archiveData;
-}
+    ReleaseMapping(path);
 
-void Rarc::Save(std::vector<uint8_t>& buffer, Compression::Format compression, uint8_t compressionLevel, bool padCompressed){
-    std::map<std::string, uint32_t> archiveSizes = CalculateArchiveSizes();
+    if(!mModified && compression != Compression::Format::None && compression == mOriginalFormat){
+        bStream::CFileStream outFile(path.string(), bStream::Endianess::Big, bStream::OpenMode::Out);
+        outFile.writeBytes(mOriginalData.data(), mOriginalData.size());
+        if(padCompressed) while(outFile.tell() < Util::AlignTo(outFile.getSize(), 0x20)) { outFile.writeUInt8(0); }
+        return true;
+    }
 
-    uint8_t* archiveData = new uint8_t[archiveSizes["total"]];
-    memset(archiveData, 0, archiveSizes["total"]);
+    std::vector<uint8_t> tables;
+    std::vector<std::span<const uint8_t>> pieces;
+    BuildLayout(tables, pieces);
 
-    uint8_t* fileSystemChunk = archiveData + 0x20;
-    uint8_t* dirChunk = archiveData + 0x40;
-    uint8_t* fileChunk = archiveData + 0x40 + archiveSizes["dirEntries"];
-    uint8_t* strTableChunk = archiveData + 0x40 + archiveSizes["dirEntries"] + archiveSizes["fileEntries"];
-    uint8_t* fileDataChunk = archiveData + 0x40 + archiveSizes["dirEntries"] + archiveSizes["fileEntries"] + archiveSizes["strTable"];
+    bStream::CFileStream outFile(path.string(), bStream::Endianess::Big, bStream::OpenMode::Out);
+    WriteLayout(pieces, &outFile, compression, compressionOptions);
+    if(padCompressed) while(outFile.tell() < Util::AlignTo(outFile.getSize(), 0x20)) { outFile.writeUInt8(0); }
+    return true;
+}
 
-    bStream::CMemoryStream headerStream(archiveData, 0x20, mArchiveOrder, bStream::OpenMode::Out);
-    bStream::CMemoryStream fileSystemStream(fileSystemChunk, 0x20, mArchiveOrder, bStream::OpenMode::Out);
-    bStream::CMemoryStream dirStream(dirChunk, archiveSizes["dirEntries"], mArchiveOrder, bStream::OpenMode::Out);
-    bStream::CMemoryStream fileStream(fileChunk, archiveSizes["fileEntries"], mArchiveOrder, bStream::OpenMode::Out);
-    bStream::CMemoryStream stringTableStream(strTableChunk, archiveSizes["strTable"], mArchiveOrder, bStream::OpenMode::Out);
-    bStream::CMemoryStream fileDataStream(fileDataChunk, archiveSizes["fileData"], mArchiveOrder, bStream::OpenMode::Out);
+bool Rarc::Save(std::vector<uint8_t>& buffer, Compression::Format compression, const Compression::Yaz0::CompressOptions& compressionOptions, bool padCompressed){
+    if(mHeadersOnly){
+        buffer.clear();
+        return false;
+    }
 
-    // Generate String Table
+    if(!mModified && compression != Compression::Format::None && compression == mOriginalFormat){
+        buffer.assign(mOriginalData.begin(), mOriginalData.end());
+        if(padCompressed) buffer.resize(Util::AlignTo(buffer.size(), 0x20));
+        return true;
+    }
 
-    std::map<std::string, uint32_t> stringTable{{".", 0x00}, {"..", 0x02}};
+    std::vector<uint8_t> tables;
+    std::vector<std::span<const uint8_t>> pieces;
+    BuildLayout(tables, pieces);
 
-    stringTableStream.writeString(".");
-    stringTableStream.writeUInt8(0x00);
-    stringTableStream.writeString("..");
-    stringTableStream.writeUInt8(0x00);
+    if(compression == Compression::Format::None){
+        // Copied straight into place, the archive is already 32 byte aligned
+        std::size_t size = 0;
+        for(auto piece : pieces) size += piece.size();
 
-    for(auto dir : mDirectories){
-        if(stringTable.count(dir->GetName()) == 0){
-            stringTable.insert({dir->GetName(), stringTableStream.tell()});
-            stringTableStream.writeString(dir->GetName());
-            stringTableStream.writeUInt8(0x00);
-        }
-        for(auto file : dir->GetFiles()){
-            if(stringTable.count(file->GetName()) == 0){
-                stringTable.insert({file->GetName(), stringTableStream.tell()});
-                stringTableStream.writeString(file->GetName());
-                stringTableStream.writeUInt8(0x00);
-            }
+        buffer.resize(size);
+        uint8_t* out = buffer.data();
+        for(auto piece : pieces){
+            std::memcpy(out, piece.data(), piece.size());
+            out += piece.size();
         }
+        return true;
     }
 
-    std::size_t currentFileIndex = 0;
+    bStream::CMemoryStream compressedOut(static_cast<std::size_t>(tables.size()), bStream::Endianess::Big, bStream::OpenMode::Out);
+    WriteLayout(pieces, &compressedOut, compression, compressionOptions);
 
-    // Write Archive Structure
-    for(std::size_t i = 0; i < mDirectories.size(); i++)
-    {
-        std::shared_ptr<Folder> folder = mDirectories[i];
+    buffer.resize(padCompressed ? Util::AlignTo(compressedOut.getSize(), 0x20) : compressedOut.getSize());
+    std::memcpy(buffer.data(), compressedOut.getBuffer(), compressedOut.getSize());
+    return true;
+}
 
-        std::string folderName = folder->GetName();
+bool Rarc::Load(std::span<const uint8_t> data, LoadMode mode){
+    return LoadBuffer(data, mode, nullptr);
+}
 
-        //Write IDs
-        if(i == 0){
-            dirStream.writeUInt32(0x524F4F54);
-        } else {
-            char temp[4];
-            memset(temp, 0x20, sizeof(temp));
-            for (std::size_t ch = 0; ch < 4; ch++){
-                if(ch >= folderName.size()) break;
-                temp[ch] = toupper(folderName[ch]);
-            }
-            // This is a hack, these are technically ints but if we treat them that way the expected IDs end up broken in BE exports.
-            // There is probably a better way to do this but im too lazy to fix it right now
-            if(dirStream.getOrder() == bStream::Endianess::Big){
-                dirStream.writeBytes(reinterpret_cast<uint8_t*>(temp), 4);
-            } else {
-                std::swap(temp[0], temp[3]);
-                std::swap(temp[1], temp[2]);
-                dirStream.writeBytes(reinterpret_cast<uint8_t*>(temp), 4);
-            }
+bool Rarc::LoadBuffer(std::span<const uint8_t> data, LoadMode mode, std::vector<uint8_t>* owned){
+    bool headersOnly = mode == LoadMode::HeadersOnly;
+    std::shared_ptr<_BufferSource> source = std::make_shared<_BufferSource>();
+    std::vector<uint8_t>& decompressedData = source->Owned();
+    Compression::ProbeResult probe = Compression::Probe(data);
+    bool keep = mKeepOriginal && !headersOnly;
+
+    mOriginalFormat = keep ? probe.mFormat : Compression::Format::None;
+    mOriginalData.clear();
+
+    if(probe.mFormat != Compression::Format::None){
+        // moving keeps the same buffer, so data still points at it
+        if(keep && owned != nullptr){
+            mOriginalData = std::move(*owned);
+        } else if(keep){
+            mOriginalData.assign(data.begin(), data.end());
         }
 
-        dirStream.writeUInt32(stringTable[folderName]); // ??????
-        dirStream.writeUInt16(Hash(folderName));
-        dirStream.writeUInt16(folder->GetFileCount() + 2);
-        dirStream.writeUInt32(currentFileIndex);
-
-        // Write File entries
-        for(auto file : folder->GetFiles()){
-            fileStream.writeUInt16(currentFileIndex);
-            fileStream.writeUInt16(Hash(file->GetName()));
-            fileStream.writeUInt8(0x01 | 0x10);
-            fileStream.writeUInt8(0x00);
+        auto decode = [&](std::size_t size){
+            decompressedData.resize(std::min(size, probe.mDecompressedSize));
+            return Compression::Decompress(data, std::span<uint8_t>(decompressedData));
+        };
 
-            std::string fileName = file->GetName();
-            fileStream.writeUInt16(stringTable[fileName]);
-            fileStream.writeUInt32(fileDataStream.tell());
-            fileStream.writeUInt32(file->GetSize());
-            fileStream.writeUInt32(0x00);
-
-            fileDataStream.writeBytes(file->GetData(), file->GetSize());
-
-            uint32_t delta = Util::PadTo32(file->GetSize()) - file->GetSize();
-            for(int x = 0; x < delta; x++){
-                fileDataStream.writeUInt8(0);
+        if(headersOnly){
+            // Decode the rarc header first to find where the fs tables end, the decoder stops there
+            if(!decode(0x20) || decompressedData.size() < 0x20){
+                return false;
             }
 
-            currentFileIndex++;
-        }
+            bStream::CMemoryStream headerStream(decompressedData.data(), decompressedData.size(), bStream::Endianess::Big, bStream::OpenMode::In);
+            if(headerStream.readUInt32() == 0x43524152) headerStream.setOrder(bStream::Endianess::Little);
 
-        // Write Subdirectory entries
-        for(auto subdir : folder->GetSubdirectories()){
-            auto subdirIter = std::find(mDirectories.begin(), mDirectories.end(), subdir);
-            fileStream.writeUInt16(0xFFFF);
-            fileStream.writeUInt16(Hash(subdir->GetName()));
-            fileStream.writeUInt8(0x02);
-            fileStream.writeUInt8(0x00);
+            headerStream.seek(8);
+            uint32_t fsOffset = headerStream.readUInt32();
+            uint32_t fsSize = headerStream.readUInt32();
 
-            std::string subdirName = subdir->GetName();
-
-            fileStream.writeUInt16(stringTable[subdirName]); // ????
-            fileStream.writeUInt32(subdirIter - mDirectories.begin());
-            fileStream.writeUInt32(0x10);
-            fileStream.writeUInt32(0x00);
-            currentFileIndex++;
+            if(!decode(fsOffset + fsSize)){
+                return false;
+            }
+        } else if(!decode(SIZE_MAX)){
+            return false;
         }
 
+        data = decompressedData;
+    }
 
-        // Write .
-        // [v]: perhaps this should be put into a function of some kind? unsure...
-        fileStream.writeUInt16(0xFFFF);
-        fileStream.writeUInt16(Hash("."));
-        fileStream.writeUInt8(0x02);
-        fileStream.writeUInt8(0x00);
-        fileStream.writeUInt16(0x00);
-        fileStream.writeUInt32(i);
-        fileStream.writeUInt32(0x10);
-        fileStream.writeUInt32(0x00);
+    source->SetData(data);
 
-        // And write ..
-        fileStream.writeUInt16(0xFFFF);
-        fileStream.writeUInt16(Hash(".."));
-        fileStream.writeUInt8(0x02);
-        fileStream.writeUInt8(0x00);
-        fileStream.writeUInt16(0x02);
-        if(folder->GetParent().lock() != nullptr){
-            auto dirIter = std::find(mDirectories.begin(), mDirectories.end(), folder->GetParent().lock());
-            fileStream.writeUInt32(dirIter - mDirectories.begin());
-        } else {
-            fileStream.writeUInt32((uint32_t)-1);
-        }
-        fileStream.writeUInt32(0x10);
-        fileStream.writeUInt32(0x00);
+    bStream::CMemoryStream rarcStream(const_cast<uint8_t*>(data.data()), data.size(), bStream::Endianess::Big, bStream::OpenMode::In);
+    return Parse(&rarcStream, mode, source);
+}
 
-        currentFileIndex += 2; // account for . and .. file entries
+bool Rarc::Load(bStream::CStream* stream, LoadMode mode){
+    // Memory streams are loaded in place, anything else is only read in if it needs decompressing
+    if(bStream::CMemoryStream* memStream = dynamic_cast<bStream::CMemoryStream*>(stream); memStream != nullptr){
+        return Load(std::span<const uint8_t>(memStream->getBuffer(), memStream->getSize()), mode);
     }
 
-    // Write Header
-    headerStream.writeUInt32(0x52415243);
-    headerStream.writeUInt32(archiveSizes["total"]);
-    headerStream.writeUInt32(fileSystemChunk - archiveData);
-    headerStream.writeUInt32(fileDataChunk - fileSystemChunk);
-    headerStream.writeUInt32(fileDataStream.getSize());
-    headerStream.writeUInt32(fileDataStream.getSize()); //TODO: mram flag!
-    headerStream.writeUInt32(0); //TODO: aram flag!
-    headerStream.writeUInt32(0); // pad
+    uint8_t header[0x10] = {};
+    stream->seek(0);
+    stream->readBytesTo(header, std::min<std::size_t>(sizeof(header), stream->getSize()));
 
-    //Write FS Header
-    fileSystemStream.writeUInt32(mDirectories.size());
-    fileSystemStream.writeUInt32(dirChunk - fileSystemChunk);
-    fileSystemStream.writeUInt32(currentFileIndex);
-    fileSystemStream.writeUInt32(fileChunk - fileSystemChunk);
-    fileSystemStream.writeUInt32(stringTableStream.getSize());
-    fileSystemStream.writeUInt32(strTableChunk - fileSystemChunk);
-    fileSystemStream.writeUInt16(currentFileIndex);
-    fileSystemStream.writeUInt8(0);
-    fileSystemStream.writeUInt8(0);
-    fileSystemStream.writeUInt32(0);
-
-
-    switch(compression){
-        case Compression::Format::None:
-            {
-                buffer.resize(archiveSizes["total"]);
-                std::memcpy(buffer.data(), archiveData, archiveSizes["total"]);
-            }
-            break;
+    if(Compression::Probe(header).mFormat != Compression::Format::None){
+        std::vector<uint8_t> compressedData(stream->getSize());
+        stream->seek(0);
+        stream->readBytesTo(compressedData.data(), compressedData.size());
+        return LoadBuffer(compressedData, mode, &compressedData);
+    }
 
-        case Compression::Format::YAY0:
-            {
-                bStream::CMemoryStream archiveOut(archiveData, archiveSizes["total"], bStream::Endianess::Big, bStream::OpenMode::In);
-                bStream::CMemoryStream compressedOut(static_cast<std::size_t>(archiveSizes["total"]), bStream::Endianess::Big, bStream::OpenMode::Out);
+    if(stream->getOrder() != bStream::Endianess::Big) stream->setOrder(bStream::Endianess::Big);
 
-                Compression::Yay0::Compress(&archiveOut, &compressedOut);
+    mOriginalFormat = Compression::Format::None;
+    mOriginalData.clear();
 
-                buffer.resize(padCompressed ? Util::AlignTo(compressedOut.getSize(), 0x20) : compressedOut.getSize());
-                std::memcpy(buffer.data(), compressedOut.getBuffer(), compressedOut.getSize());
-            }
-            break;
-        case Compression::Format::YAZ0:
-            {
-                bStream::CMemoryStream archiveOut(archiveData, archiveSizes["total"], bStream::Endianess::Big, bStream::OpenMode::In);
-                bStream::CMemoryStream compressedOut(static_cast<std::size_t>(archiveSizes["total"]), bStream::Endianess::Big, bStream::OpenMode::Out);
+    return Parse(stream, mode, std::make_shared<_StreamSource>(stream));
+}
 
-                Compression::Yaz0::Compress(&archiveOut, &compressedOut, compressionLevel);
+bool Rarc::LoadMapped(std::filesystem::path path){
+    std::shared_ptr<_MappedSource> mapping = std::make_shared<_MappedSource>();
+    if(!mapping->File().Open(path)){
+        return false;
+    }
 
-                buffer.resize(padCompressed ? Util::AlignTo(compressedOut.getSize(), 0x20) : compressedOut.getSize());
-                std::memcpy(buffer.data(), compressedOut.getBuffer(), compressedOut.getSize());
-            }
-            break;
+    std::span<const uint8_t> data(mapping->File().GetData(), mapping->File().GetSize());
+    if(Compression::Probe(data).mFormat != Compression::Format::None){
+        return Load(data);
     }
 
+    mOriginalFormat = Compression::Format::None;
+    mOriginalData.clear();
+    mMapping = mapping;
+    mMappedPath = path;
 
-    delete[] archiveData;
+    bStream::CMemoryStream rarcStream(mapping->File().GetData(), mapping->File().GetSize(), bStream::Endianess::Big, bStream::OpenMode::In);
+    return Parse(&rarcStream, LoadMode::Lazy, mapping);
 }
 
 // Needs error checking
-bool Rarc::Load(bStream::CStream* stream){
-    bStream::CMemoryStream decompressedArcStream(1, bStream::Endianess::Big, bStream::OpenMode::Out);
-
-    bStream::CStream* rarcStream = stream;
-
-    if(stream->getOrder() != bStream::Endianess::Big) stream->setOrder(bStream::Endianess::Big);
-
-    uint32_t magic = stream->readUInt32();
-
-    if(magic == 0x59617A30){
-        decompressedArcStream.Reserve(Compression::GetDecompressedSize(stream));
-        Compression::Yaz0::Decompress(stream, &decompressedArcStream);
-        decompressedArcStream.changeMode(bStream::OpenMode::In);
-        rarcStream = &decompressedArcStream;
-    } else if(magic == 0x59617930){
-        decompressedArcStream.Reserve(Compression::GetDecompressedSize(stream));
-        Compression::Yay0::Decompress(stream, &decompressedArcStream);
-        decompressedArcStream.changeMode(bStream::OpenMode::In);
-        rarcStream = &decompressedArcStream;
-    }
-
+bool Rarc::Parse(bStream::CStream* rarcStream, LoadMode mode, std::shared_ptr<FileSource> source){
+    mHeadersOnly = mode == LoadMode::HeadersOnly;
     rarcStream->seek(0);
 
-    magic = rarcStream->readUInt32();
+    uint32_t magic = rarcStream->readUInt32();
 
     if(magic == 0x43524152){
         rarcStream->setOrder(bStream::Endianess::Little);
@@ -630,7 +1008,10 @@ bool Rarc::Load(bStream::CStream* stream){
     uint32_t strTableSize = rarcStream->readUInt32();
     uint32_t strTableOffset = rarcStream->readUInt32();
 
-    for(std::size_t i = 0; i < dirCount; i++) mDirectories.push_back(Folder::Create(GetPtr()));
+    for(std::size_t i = 0; i < dirCount; i++) AddDirectory(Folder::Create(GetPtr()));
+
+    // files read in so far by their data's hash, only filled when deduplicating
+    std::unordered_multimap<uint64_t, std::shared_ptr<File>> loadedData;
 
     rarcStream->seek(dirOffset + fsOffset);
     for(std::size_t i = 0; i < dirCount; i++)
@@ -688,20 +1069,84 @@ bool Rarc::Load(bStream::CStream* stream){
 
             rarcStream->skip(4);
 
-            if(attr & 0x01){
-
-                unsigned char* fileData = new unsigned char[fileSize];
+            if((attr & 0x01) && (mode == LoadMode::HeadersOnly || (mode == LoadMode::Lazy && !(attr & 0x04)))){
+                file->SetName(name);
+                file->mSize = fileSize;
+                file->mDataOffset = start;
+                if(attr & 0x04){
+                    file->mCompression = (attr & 0x80) ? Compression::Format::YAZ0 : Compression::Format::YAY0;
+                }
+                if(mode == LoadMode::Lazy){
+                    if(uint8_t* view = source->View(fsOffset + fsSize + start, fileSize); view != nullptr){
+                        file->mData = view;
+                        file->mMapping = source;
+                    } else {
+                        file->mSource = source;
+                        file->mSourceOffset = fsOffset + fsSize + start;
+                    }
+                }
+                folder->AddFile(file);
+            } else if((attr & 0x01) && (attr & 0x04)){
+                // Compressed entries keep their stored bytes and decompress on first GetData. The magic says
+                // which format it is, 0x80 should agree with it
+                std::vector<uint8_t> stored(fileSize);
 
                 std::size_t pos = rarcStream->tell();
                 rarcStream->seek(fsOffset + fsSize + start);
-                rarcStream->readBytesTo(fileData, fileSize);
+                rarcStream->readBytesTo(stored.data(), fileSize);
                 rarcStream->seek(pos);
 
+                Compression::ProbeResult probe = Compression::Probe(stored);
+                if(probe.mFormat != Compression::Format::None){
+                    file->mCompression = probe.mFormat;
+                    file->mEncodedFormat = probe.mFormat;
+                    file->mEncodeValid = true;
+                    file->mEncoded = std::move(stored);
+                    file->mSize = probe.mDecompressedSize;
+                } else {
+                    file->mData = new uint8_t[fileSize];
+                    file->mSize = fileSize;
+                    std::memcpy(file->mData, stored.data(), fileSize);
+                }
+
                 file->SetName(name);
-                file->SetData(fileData, fileSize);
+                file->mDataOffset = start;
                 folder->AddFile(file);
+            } else if(attr & 0x01){
+                // read straight into the file, SetData would copy it again
+                file->mData = new uint8_t[fileSize];
+                file->mSize = fileSize;
+
+                std::size_t pos = rarcStream->tell();
+                rarcStream->seek(fsOffset + fsSize + start);
+                rarcStream->readBytesTo(file->mData, fileSize);
+                rarcStream->seek(pos);
 
-                delete[] fileData;
+                // identical data loaded before, both files share that buffer from now on
+                if(mDeduplicate){
+                    std::span<const uint8_t> data(file->mData, fileSize);
+                    uint64_t hash = Util::Hash(data);
+                    auto [first, last] = loadedData.equal_range(hash);
+                    auto original = std::find_if(first, last, [&](auto& loaded){
+                        return loaded.second->mSize == fileSize && std::equal(data.begin(), data.end(), loaded.second->mData);
+                    });
+
+                    if(original != last){
+                        std::shared_ptr<File> shared = original->second;
+                        if(shared->mMapping == nullptr){
+                            shared->mMapping = std::make_shared<_SharedSource>(shared->mData, shared->mSize);
+                        }
+                        delete[] file->mData;
+                        file->mData = shared->mData;
+                        file->mMapping = shared->mMapping;
+                    } else {
+                        loadedData.insert({ hash, file });
+                    }
+                }
+
+                file->SetName(name);
+                file->mDataOffset = start;
+                folder->AddFile(file);
             } else if(attr & 0x02) {
                 if(start != -1 && name != ".." && name != "."){
                     folder->AddSubdirectory(mDirectories[start]);
@@ -711,6 +1156,10 @@ bool Rarc::Load(bStream::CStream* stream){
         }
         rarcStream->seek(pos);
     }
+
+    // Building the tree goes through the same setters as edits do
+    Recount();
+    mModified = false;
     return true;
 }
 }
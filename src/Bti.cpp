@@ -785,6 +785,20 @@ void Bti::SetData(uint16_t width, uint16_t height, uint8_t* imageData){
     std::memcpy(mImageData, imageData, (mWidth*mHeight*4));
 }
 
+uint64_t Bti::HeaderHash(){
+    uint32_t header[] = {
+        mFormat, mEnableAlpha, mWidth, mHeight, mWrapS, mWrapT, mPaletteFormat, mNumPaletteEntries, mPaletteOffsetData,
+        mMipMapEnabled, mEdgeLODEnabled, mClampLODBias, mMaxAnisotropy, mMinFilterType, mMagFilterType, mMinLOD, mMaxLOD,
+        mNumImages, mLODBias
+    };
+    return Util::Hash(std::span<const uint8_t>((uint8_t*)header, sizeof(header)));
+}
+
+uint64_t Bti::PixelHash(){
+    if(mImageData == nullptr) return 0;
+    return Util::Hash(std::span<const uint8_t>(mImageData, mWidth * mHeight * 4));
+}
+
 void Bti::Save(bStream::CStream* stream){
     stream->writeUInt8(mFormat);
     stream->writeUInt8(mEnableAlpha);
@@ -814,6 +828,12 @@ void Bti::Save(bStream::CStream* stream){
 
     while(stream->tell() != dataOffset) stream->writeUInt8(0);
 
+    // Header is checked first, the pixel buffer is only the size it hashes if width and height are unchanged
+    if(!mOriginalImage.empty() && HeaderHash() == mOriginalHeaderHash && PixelHash() == mOriginalPixelHash){
+        stream->writeBytes(mOriginalImage.data(), mOriginalImage.size());
+        return;
+    }
+
     switch (mFormat){
     case 0x00:
         ImageFormat::Encode::I4(stream, mWidth, mHeight, mImageData);
@@ -906,6 +926,16 @@ bool Bti::Load(bStream::CStream* stream){
         break;
     }
 
+    mOriginalImage.clear();
+    if(mKeepOriginal){
+        mOriginalImage.resize(stream->tell() - imageDataOffset);
+        stream->seek(imageDataOffset);
+        stream->readBytesTo(mOriginalImage.data(), mOriginalImage.size());
+
+        mOriginalHeaderHash = HeaderHash();
+        mOriginalPixelHash = PixelHash();
+    }
+
     return true;
 }
 
@@ -1,4 +1,33 @@
 #include "Compression.hpp"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define GCTOOLS_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define GCTOOLS_TARGET(x) __attribute__((target(x)))
+#else
+#define GCTOOLS_TARGET(x)
+#endif
 
 namespace Compression {
 
@@ -12,181 +41,1050 @@ std::size_t GetDecompressedSize(bStream::CStream* stream){
     return decompressedSize;
 }
 
-namespace Yaz0 {
+std::size_t GetDecompressedSize(std::span<const uint8_t> data){
+    if(data.size() < 8) return 0;
+    return (data[4] << 24) | (data[5] << 16) | (data[6] << 8) | data[7];
+}
+
+ProbeResult Probe(std::span<const uint8_t> data){
+    ProbeResult result { Format::None, data.size(), 0 };
+
+    if(data.size() < 16) return result;
+
+    uint32_t magic = (data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+    if(magic == 0x59617A30){
+        result.mFormat = Format::YAZ0;
+    } else if(magic == 0x59617930){
+        result.mFormat = Format::YAY0;
+    } else {
+        return result;
+    }
+
+    result.mDecompressedSize = GetDecompressedSize(data);
+    result.mHeaderSize = 16;
+    return result;
+}
+
+// Copies a back reference of len bytes starting dist bytes behind out, 8 bytes at a time once the
+// chunks no longer overlap their source. room is how much of the output is left from out, when
+// there is slack the last chunk is written whole, the extra bytes get overwritten by later tokens.
+// Short distances are repeating patterns, those are doubled up to a period of at least 8 first.
+static inline void CopyMatch(uint8_t* out, std::size_t dist, std::size_t len, std::size_t room){
+    const uint8_t* from = out - dist;
+
+    if(dist < 8){
+        if(len < 16){
+            while(len-- > 0) *out++ = *from++;
+            return;
+        }
+
+        for(std::size_t i = 0; i < 8; i++) out[i] = from[i];
+        out += 8;
+        len -= 8;
+        room -= 8;
+        dist = 8 / dist * dist + dist; // multiple of the original period, no more than what was just written
+        from = out - dist;
+    }
+
+    if(len + 8 <= room){
+        for(std::size_t i = 0; i < len; i += 8) std::memcpy(out + i, from + i, 8);
+        return;
+    }
+
+    for(; len >= 8; len -= 8, out += 8, from += 8) std::memcpy(out, from, 8);
+    while(len-- > 0) *out++ = *from++;
+}
+
+// Match length kernels, each returns how many bytes a and b have in common up to max and never reads past max
+
+static inline std::size_t FirstMismatch(uint64_t a, uint64_t b){
+    uint64_t diff = a ^ b;
+    if constexpr(std::endian::native == std::endian::little){
+        return std::countr_zero(diff) / 8;
+    } else {
+        return std::countl_zero(diff) / 8;
+    }
+}
+
+static std::size_t MatchLengthScalar(const uint8_t* a, const uint8_t* b, std::size_t max){
+    std::size_t length = 0;
+    for(; length + 8 <= max; length += 8){
+        uint64_t wa, wb;
+        std::memcpy(&wa, a + length, 8);
+        std::memcpy(&wb, b + length, 8);
+        if(wa != wb) return length + FirstMismatch(wa, wb);
+    }
+    while(length < max && a[length] == b[length]) length++;
+    return length;
+}
+
+#ifdef GCTOOLS_X86
+GCTOOLS_TARGET("sse2")
+static std::size_t MatchLengthSSE2(const uint8_t* a, const uint8_t* b, std::size_t max){
+    std::size_t length = 0;
+    for(; length + 16 <= max; length += 16){
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + length));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + length));
+        uint32_t mask = ~(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) & 0xFFFF;
+        if(mask != 0) return length + std::countr_zero(mask);
+    }
+    return length + MatchLengthScalar(a + length, b + length, max - length);
+}
+
+GCTOOLS_TARGET("avx2")
+static std::size_t MatchLengthAVX2(const uint8_t* a, const uint8_t* b, std::size_t max){
+    std::size_t length = 0;
+    for(; length + 32 <= max; length += 32){
+        __m256i va = _mm256_loadu_si256((const __m256i*)(a + length));
+        __m256i vb = _mm256_loadu_si256((const __m256i*)(b + length));
+        uint32_t mask = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb));
+        if(mask != 0) return length + std::countr_zero(mask);
+    }
+    return length + MatchLengthSSE2(a + length, b + length, max - length);
+}
+
+// 32 bit builds can't count on SSE2, every x86_64 cpu has it
+static bool HasSSE2(){
+#if defined(__x86_64__) || defined(_M_X64)
+    return true;
+#elif defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return info[3] & (1 << 26);
+#else
+    return __builtin_cpu_supports("sse2");
+#endif
+}
+
+static bool HasAVX2(){
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if(info[0] < 7) return false;
+    __cpuid(info, 1);
+    bool osSavesYmm = (info[2] & (1 << 27)) && (_xgetbv(0) & 6) == 6;
+    __cpuidex(info, 7, 0);
+    return osSavesYmm && (info[1] & (1 << 5));
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+using MatchLengthKernel = std::size_t(*)(const uint8_t*, const uint8_t*, std::size_t);
+
+// Picked once by cpu feature. Most matches end in their first 8 bytes, those never leave the scalar check
+static inline std::size_t MatchLength(const uint8_t* a, const uint8_t* b, std::size_t max){
+    if(max >= 8){
+        uint64_t wa, wb;
+        std::memcpy(&wa, a, 8);
+        std::memcpy(&wb, b, 8);
+        if(wa != wb) return FirstMismatch(wa, wb);
+    } else {
+        return MatchLengthScalar(a, b, max);
+    }
+
+#ifdef GCTOOLS_X86
+    static const MatchLengthKernel kernel = HasAVX2() ? MatchLengthAVX2 : HasSSE2() ? MatchLengthSSE2 : MatchLengthScalar;
+#else
+    static const MatchLengthKernel kernel = MatchLengthScalar;
+#endif
+    return 8 + kernel(a + 8, b + 8, max - 8);
+}
+
+///
+/// Cache
+///
+
+static std::mutex CacheLock;
+static std::shared_ptr<Cache> ActiveCache;
+
+void SetCache(std::shared_ptr<Cache> cache){
+    std::lock_guard<std::mutex> lock(CacheLock);
+    ActiveCache = cache;
+}
+
+std::shared_ptr<Cache> GetCache(){
+    std::lock_guard<std::mutex> lock(CacheLock);
+    return ActiveCache;
+}
+
+Cache::Cache(std::filesystem::path directory, std::uintmax_t maxSize){
+    mDirectory = directory;
+    mMaxSize = maxSize;
+
+    std::error_code err;
+    std::filesystem::create_directories(mDirectory, err);
+    for(auto& entry : std::filesystem::directory_iterator(mDirectory, err)){
+        if(entry.is_regular_file(err) && entry.path().extension() != ".tmp") mSize += entry.file_size(err);
+    }
+}
+
+// Entries are the data followed by its length and hash, both 8 bytes little endian
+static constexpr std::size_t CacheTrailerSize = 16;
+
+static void WriteUInt64LE(uint8_t* dst, uint64_t value){
+    for(int i = 0; i < 8; i++) dst[i] = value >> (i * 8);
+}
+
+static uint64_t ReadUInt64LE(const uint8_t* src){
+    uint64_t value = 0;
+    for(int i = 0; i < 8; i++) value |= (uint64_t)src[i] << (i * 8);
+    return value;
+}
+
+std::filesystem::path Cache::EntryPath(uint64_t key){
+    char name[17];
+    std::snprintf(name, sizeof(name), "%016llx", (unsigned long long)key);
+    return mDirectory / name;
+}
+
+// Reads without the lock. Replacing an entry renames a whole new file over it, so the file opened here is
+// either all of one version or gone, and one evicted meanwhile is just a miss
+bool Cache::Get(uint64_t key, std::vector<uint8_t>& data){
+    std::filesystem::path path = EntryPath(key);
+
+    std::ifstream entry(path, std::ios::binary | std::ios::ate);
+    if(!entry.is_open()) return false;
+
+    // the size of the file that was opened, not of whatever is at path by now
+    std::streamsize size = entry.tellg();
+    if(size < 0) return false;
+
+    entry.seekg(0);
+    data.resize(size);
+    bool read = entry.read(reinterpret_cast<char*>(data.data()), size) && entry.gcount() == size;
+    entry.close();
+
+    bool valid = read && (std::size_t)size >= CacheTrailerSize;
+    if(valid){
+        std::size_t length = size - CacheTrailerSize;
+        valid = ReadUInt64LE(data.data() + length) == length &&
+                ReadUInt64LE(data.data() + length + 8) == Util::Hash(std::span<const uint8_t>(data.data(), length));
+    }
+
+    std::error_code err;
+    if(!valid){
+        // cut short by a full disk or a crash, or damaged since. Either way it's of no use
+        data.clear();
+        if(read){
+            std::lock_guard<std::mutex> lock(mLock);
+            if(std::filesystem::remove(path, err)) mSize -= std::min<std::uintmax_t>(mSize, size);
+        }
+        return false;
+    }
+
+    data.resize(size - CacheTrailerSize);
+
+    // Touch the entry so eviction sees it as recently used
+    std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), err);
+    return true;
+}
+
+void Cache::Put(uint64_t key, std::span<const uint8_t> data){
+    std::filesystem::path path = EntryPath(key);
+
+    uint8_t trailer[CacheTrailerSize];
+    WriteUInt64LE(trailer, data.size());
+    WriteUInt64LE(trailer + 8, Util::Hash(data));
+
+    // Written under a unique name and renamed so readers never see a partial entry
+    char suffix[24];
+    std::snprintf(suffix, sizeof(suffix), ".%08x.tmp", (unsigned int)std::random_device{}());
+    std::filesystem::path temp = path;
+    temp += suffix;
+
+    std::error_code err;
+    {
+        std::ofstream entry(temp, std::ios::binary | std::ios::trunc);
+        entry.write(reinterpret_cast<const char*>(data.data()), data.size());
+        entry.write(reinterpret_cast<const char*>(trailer), sizeof(trailer));
+        entry.close();
+
+        if(entry.fail()){
+            std::filesystem::remove(temp, err);
+            return;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mLock);
+
+    // an entry being replaced stops counting towards the size
+    std::uintmax_t replaced = std::filesystem::file_size(path, err);
+    if(err) replaced = 0;
+
+    std::filesystem::rename(temp, path, err);
+    if(err){
+        std::filesystem::remove(temp, err);
+        return;
+    }
+
+    mSize = mSize - std::min(mSize, replaced) + data.size() + sizeof(trailer);
+    if(mSize > mMaxSize) Evict();
+}
+
+// Trims to 90% of the limit so the puts right after don't each rescan the directory
+void Cache::Evict(){
+    struct Entry {
+        std::filesystem::file_time_type mTime;
+        std::uintmax_t mSize;
+        std::filesystem::path mPath;
+    };
+
+    std::error_code err;
+    std::vector<Entry> entries;
+    mSize = 0;
+
+    for(auto& entry : std::filesystem::directory_iterator(mDirectory, err)){
+        if(!entry.is_regular_file(err) || entry.path().extension() == ".tmp") continue;
+        entries.push_back({ entry.last_write_time(err), entry.file_size(err), entry.path() });
+        mSize += entries.back().mSize;
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b){ return a.mTime < b.mTime; });
+
+    std::uintmax_t target = mMaxSize / 10 * 9;
+    for(auto& entry : entries){
+        if(mSize <= target) break;
+        if(std::filesystem::remove(entry.mPath, err)) mSize -= entry.mSize;
+    }
+}
+
+// Every setting that changes the encoder's output goes into the key along with the input
+static uint64_t CacheKey(std::span<const uint8_t> src, Format format, const Yaz0::CompressOptions& options, uint64_t variant){
+    uint64_t settings[] = {
+        (uint64_t)format, options.mSearchRange, options.mMaxChainDepth, options.mNiceLength,
+        options.mLazyMatching, options.mStoreOnly, variant
+    };
+    uint64_t seed = Util::Hash(std::span<const uint8_t>((const uint8_t*)settings, sizeof(settings)));
+    return Util::Hash(src, seed);
+}
+
+// Cached files are stored with a big endian header regardless of the destination stream
+static std::vector<uint8_t> CacheEntry(const char* magic, uint32_t size, uint32_t field1, uint32_t field2, std::initializer_list<std::span<const uint8_t>> sections){
+    std::vector<uint8_t> entry(magic, magic + 4);
+    for(uint32_t value : { size, field1, field2 }){
+        for(int shift = 24; shift >= 0; shift -= 8) entry.push_back(value >> shift);
+    }
+    for(auto section : sections){
+        entry.insert(entry.end(), section.begin(), section.end());
+    }
+    return entry;
+}
+
+///
+/// Workers
+///
+
+// Threads shared by every batch, started the first time one runs. The thread that starts a batch works
+// on it too and only waits for jobs a worker already picked up, so jobs can start batches of their own
+class _WorkerPool {
+    std::mutex mLock;
+    std::condition_variable mWake;
+    std::deque<std::function<void()>> mTasks;
+    std::vector<std::thread> mWorkers;
+    bool mStopping { false };
+
+public:
+    std::size_t Size() { return mWorkers.size(); }
+
+    void Post(std::function<void()> task){
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            mTasks.push_back(std::move(task));
+        }
+        mWake.notify_one();
+    }
+
+    _WorkerPool(){
+        std::size_t count = std::max(1u, std::thread::hardware_concurrency()) - 1;
+        for(std::size_t i = 0; i < count; i++){
+            mWorkers.emplace_back([this](){
+                while(true){
+                    std::function<void()> task;
+                    {
+                        std::unique_lock<std::mutex> lock(mLock);
+                        mWake.wait(lock, [this](){ return mStopping || !mTasks.empty(); });
+                        if(mTasks.empty()) return;
+                        task = std::move(mTasks.front());
+                        mTasks.pop_front();
+                    }
+                    task();
+                }
+            });
+        }
+    }
+
+    ~_WorkerPool(){
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            mStopping = true;
+        }
+        mWake.notify_all();
+        for(auto& worker : mWorkers){
+            worker.join();
+        }
+    }
+};
+
+static _WorkerPool& WorkerPool(){
+    static _WorkerPool pool;
+    return pool;
+}
+
+struct _Batch {
+    std::function<void(std::size_t)> mWork;
+    std::size_t mCount { 0 };
+    std::atomic<std::size_t> mNext { 0 };
+
+    std::mutex mLock;
+    std::condition_variable mFinished;
+    std::size_t mDone { 0 };
+
+    // Runs unclaimed items until there are none left. mWork is only touched after claiming one,
+    // so a worker that gets here after the batch returned just leaves
+    void Drain(){
+        std::size_t finished = 0;
+        for(std::size_t i = mNext++; i < mCount; i = mNext++){
+            mWork(i);
+            finished++;
+        }
+        if(finished == 0) return;
+
+        std::lock_guard<std::mutex> lock(mLock);
+        mDone += finished;
+        if(mDone == mCount) mFinished.notify_all();
+    }
+};
+
+// Calls work(i) for every i in [0, count) on up to threadCount threads including this one, 0 uses every
+// hardware thread. Returns once every call has, the pool caps how many run at once across all batches
+static void RunParallel(std::size_t count, uint32_t threadCount, std::function<void(std::size_t)> work){
+    if(threadCount == 0) threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+    _WorkerPool& pool = WorkerPool();
+    std::size_t helpers = std::min<std::size_t>({ threadCount, count, pool.Size() + 1 });
+    if(helpers <= 1){
+        for(std::size_t i = 0; i < count; i++) work(i);
+        return;
+    }
+
+    auto batch = std::make_shared<_Batch>();
+    batch->mWork = std::move(work);
+    batch->mCount = count;
+
+    for(std::size_t t = 1; t < helpers; t++){
+        pool.Post([batch](){ batch->Drain(); });
+    }
+    batch->Drain();
+
+    std::unique_lock<std::mutex> lock(batch->mLock);
+    batch->mFinished.wait(lock, [&batch](){ return batch->mDone == batch->mCount; });
+}
 
 struct _MatchResult {
     std::size_t position;
     std::size_t length;
 };
 
+// Hash chains over 3 byte prefixes. mHead holds the newest position for each hash,
+// mPrev links every position in the window to the previous one with the same hash.
+// With a long prefix set a second set of chains links positions whose first mLongPrefix bytes hash
+// the same, Find walks those first. On data with few distinct bytes most of the window shares each
+// 3 byte prefix, and a depth limited walk of those chains stops before reaching the longer matches
+struct _MatchFinder {
+    static constexpr std::size_t HashBits = 15;
+    static constexpr std::size_t WindowSize = 0x1000;
+    static constexpr int32_t Empty = -1;
+
+    uint8_t* mSrc { nullptr };
+    std::size_t mSrcSize { 0 };
+    std::size_t mSearchRange { 0 };
+    std::size_t mChainDepth { 0 };
+    std::size_t mNiceLength { 0 };
+    std::size_t mNextInsert { 0 };
+    std::size_t mLongPrefix { 0 };
+
+    uint32_t mHashBits { HashBits };
+    int32_t* mHead { nullptr };
+    int32_t* mPrev { nullptr };
+    int32_t* mLongHead { nullptr };
+    int32_t* mLongPrev { nullptr };
+
+    uint32_t HashAt(uint8_t* p){
+        return ((p[0] << 16 | p[1] << 8 | p[2]) * 0x9E3779B1u) >> (32 - mHashBits);
+    }
 
-void Decompress(bStream::CStream* src_data, bStream::CStream* dst_data, uint32_t offset, uint32_t length){
-    uint32_t count = 0, src_pos = 0, dst_pos = 0;
-    uint8_t bits;
+    // The first mLongPrefix bytes as two little endian words, read whole when there is room
+    uint32_t LongHashAt(std::size_t pos){
+        uint64_t lo = 0, hi = 0;
+        if(std::endian::native == std::endian::little && pos + 16 <= mSrcSize){
+            std::memcpy(&lo, mSrc + pos, 8);
+            std::memcpy(&hi, mSrc + pos + 8, 8);
+        } else {
+            for(std::size_t i = 0; i < 8 && pos + i < mSrcSize; i++) lo |= (uint64_t)mSrc[pos + i] << (8 * i);
+            for(std::size_t i = 8; i < 16 && pos + i < mSrcSize; i++) hi |= (uint64_t)mSrc[pos + i] << (8 * (i - 8));
+        }
+        lo &= mLongPrefix >= 8 ? ~0ull : (1ull << (8 * mLongPrefix)) - 1;
+        hi &= mLongPrefix >= 16 ? ~0ull : mLongPrefix <= 8 ? 0 : (1ull << (8 * (mLongPrefix - 8))) - 1;
+        return ((lo * 0x9E3779B97F4A7C15ull) ^ (hi * 0xC2B2AE3D27D4EB4Full)) >> (64 - mHashBits);
+    }
 
-    std::size_t decompressedSize = length;
-    uint8_t* src = new uint8_t[src_data->getSize()];
-    
-    if(length == 0){
-        src_data->seek(4);
-        decompressedSize = src_data->readUInt32(); 
+    void Insert(std::size_t pos){
+        if(pos + 2 >= mSrcSize) return;
+
+        uint32_t hash = HashAt(mSrc + pos);
+        mPrev[pos & (WindowSize - 1)] = mHead[hash];
+        mHead[hash] = pos;
+
+        if(mLongPrefix == 0) return;
+        if(pos + mLongPrefix <= mSrcSize){
+            hash = LongHashAt(pos);
+            mLongPrev[pos & (WindowSize - 1)] = mLongHead[hash];
+            mLongHead[hash] = pos;
+        } else {
+            mLongPrev[pos & (WindowSize - 1)] = Empty;
+        }
     }
-    
-    uint8_t* dst = new uint8_t[decompressedSize];
 
-    src_data->seek(0);
-    src_data->readBytesTo(src, src_data->getSize());
+    // Hashes every position up to end that hasn't been yet
+    void InsertUpTo(std::size_t end){
+        for(; mNextInsert < end; mNextInsert++){
+            Insert(mNextInsert);
+        }
+    }
+
+    // Follows one chain from matchPtr, result only changes when a longer match turns up
+    void Walk(int32_t matchPtr, int32_t* prev, std::size_t readPtr, std::size_t matchMaxLength, _MatchResult& result){
+        std::size_t windowEnd = std::min(readPtr + matchMaxLength, mSrcSize);
+        std::size_t windowStart = readPtr > mSearchRange ? readPtr - mSearchRange : 0;
+
+        for(std::size_t depth = 0; matchPtr != Empty && depth < mChainDepth; depth++){
+            if((std::size_t)matchPtr < windowStart) break;
+
+            if(mSrc[matchPtr] == mSrc[readPtr] && mSrc[matchPtr + 1] == mSrc[readPtr + 1] && mSrc[matchPtr + 2] == mSrc[readPtr + 2]){
+                std::size_t matchLength = 3 + MatchLength(mSrc + matchPtr + 3, mSrc + readPtr + 3, windowEnd - readPtr - 3);
+
+                if(result.length < matchLength){
+                    result.length = matchLength;
+                    result.position = matchPtr;
+                    if(result.length == matchMaxLength || result.length >= mNiceLength){
+                        break;
+                    }
+                }
+            }
+
+            int32_t next = prev[matchPtr & (WindowSize - 1)];
+            if(next >= matchPtr) break; // slot was reused by a newer position
+            matchPtr = next;
+        }
+    }
+
+    _MatchResult Find(std::size_t readPtr, std::size_t matchMaxLength){
+        _MatchResult result = {0, 1};
 
-    src_pos = 16;
-    while(dst_pos < decompressedSize) {
+        if(readPtr + 2 >= mSrcSize) return result;
+
+        // anything the short chains could add past mLongPrefix bytes is on the long chains too
+        if(mLongPrefix != 0 && readPtr + mLongPrefix <= mSrcSize && matchMaxLength >= mLongPrefix){
+            Walk(mLongHead[LongHashAt(readPtr)], mLongPrev, readPtr, matchMaxLength, result);
+            if(result.length >= mLongPrefix) return result;
+        }
+
+        Walk(mHead[HashAt(mSrc + readPtr)], mPrev, readPtr, matchMaxLength, result);
+        return result;
+    }
+
+    // Moves every position back by shift once the caller has dropped the first shift bytes of mSrc.
+    // shift has to be a multiple of WindowSize so positions keep their mPrev slots
+    void Rebase(std::size_t shift){
+        auto move = [shift](int32_t& pos){ pos = pos >= (int32_t)shift ? pos - (int32_t)shift : Empty; };
+        std::size_t hashSize = std::size_t(1) << mHashBits;
+        std::for_each(mHead, mHead + hashSize, move);
+        std::for_each(mPrev, mPrev + WindowSize, move);
+        if(mLongPrefix != 0){
+            std::for_each(mLongHead, mLongHead + hashSize, move);
+            std::for_each(mLongPrev, mLongPrev + WindowSize, move);
+        }
+        mNextInsert -= shift;
+    }
+
+    // longPrefix 0 leaves out the long chains, smaller hashBits make the tables cheaper to set up for small inputs
+    _MatchFinder(uint8_t* src, std::size_t srcSize, const Yaz0::CompressOptions& options, std::size_t longPrefix=0, uint32_t hashBits=HashBits){
+        mSrc = src;
+        mSrcSize = srcSize;
+        mSearchRange = std::min(options.mSearchRange, WindowSize);
+        mChainDepth = options.mMaxChainDepth;
+        mNiceLength = options.mNiceLength;
+        mLongPrefix = longPrefix;
+        mHashBits = hashBits;
+
+        std::size_t hashSize = std::size_t(1) << mHashBits;
+        mHead = new int32_t[hashSize];
+        mPrev = new int32_t[WindowSize];
+        std::fill(mHead, mHead + hashSize, Empty);
+        std::fill(mPrev, mPrev + WindowSize, Empty);
+
+        if(mLongPrefix != 0){
+            mLongHead = new int32_t[hashSize];
+            mLongPrev = new int32_t[WindowSize];
+            std::fill(mLongHead, mLongHead + hashSize, Empty);
+            std::fill(mLongPrev, mLongPrev + WindowSize, Empty);
+        }
+    }
+
+    ~_MatchFinder(){
+        delete[] mHead;
+        delete[] mPrev;
+        delete[] mLongHead;
+        delete[] mLongPrev;
+    }
+};
+
+// Picks the token at readPtr and hashes every position it covers, a length under 3 means a literal.
+// With lazy matching a match is dropped for a literal when the next byte starts a longer one
+static _MatchResult NextToken(_MatchFinder& finder, std::size_t readPtr, std::size_t maxLength, const Yaz0::CompressOptions& options){
+    if(options.mStoreOnly) return {0, 1};
+
+    _MatchResult match = finder.Find(readPtr, maxLength);
+
+    if(options.mLazyMatching && match.length > 2 && match.length < options.mNiceLength){
+        finder.InsertUpTo(readPtr + 1);
+        if(finder.Find(readPtr + 1, maxLength).length > match.length){
+            match = {0, 1};
+        }
+    }
+
+    finder.InsertUpTo(readPtr + (match.length > 2 ? match.length : 1));
+    return match;
+}
+
+namespace Yaz0 {
+
+// level 1-9 scales the search window, anything outside that is clamped to it. Chains are walked to their end
+// at every level, which finds the same match lengths as an exhaustive search of the window
+CompressOptions::CompressOptions(uint8_t level){
+    level = std::clamp<uint8_t>(level, 1, 9);
+    mSearchRange = 0x10E0 * level / 9 - 0x0E0;
+}
+
+// Where the decoder is in the token stream, only valid between tokens
+struct _DecoderState {
+    std::size_t mSrcPos { 16 };
+    uint8_t mBits { 0 };
+    uint8_t mBitCount { 0 };
+};
+
+// Decodes whole tokens into out starting at outPos until outPos reaches stop. A match that runs
+// past the end of out is cut short, so out should have room for one more token past stop (0x111
+// bytes) unless stop is the end of the file.
+static bool DecodeTokens(std::span<const uint8_t> src, std::span<uint8_t> out, std::size_t& outPos, std::size_t stop, _DecoderState& state){
+    std::size_t src_pos = state.mSrcPos, dst_pos = outPos;
+    uint32_t count = state.mBitCount;
+    uint8_t bits = state.mBits;
+
+    while(dst_pos < stop) {
         if(count == 0){
+            if(src_pos >= src.size()) return false;
             bits = src[src_pos];
             ++src_pos;
             count = 8;
+
+            // 8 literals in a row
+            if(bits == 0xFF && src_pos + 8 <= src.size() && dst_pos + 8 <= out.size()){
+                std::memcpy(out.data() + dst_pos, src.data() + src_pos, 8);
+                src_pos += 8;
+                dst_pos += 8;
+                count = 0;
+                continue;
+            }
         }
-        
+
         if((bits & 0x80) != 0){
-            dst[dst_pos] = src[src_pos];
+            if(src_pos >= src.size()) return false;
+            out[dst_pos] = src[src_pos];
             dst_pos++;
             src_pos++;
 
         } else {
+            if(src_pos + 1 >= src.size()) return false;
             uint8_t b1 = src[src_pos], b2 = src[src_pos + 1];
 
-            uint32_t len = b1 >> 4;
-            uint32_t dist = ((b1 & 0xF) << 8) | b2;
-            uint32_t copy_src = dst_pos - (dist + 1);
+            std::size_t len = b1 >> 4;
+            std::size_t dist = (((b1 & 0xF) << 8) | b2) + 1;
 
             src_pos += 2;
 
             if(len == 0){
+                if(src_pos >= src.size()) return false;
                 len = src[src_pos] + 0x12;
                 src_pos++;
             } else {
                 len += 2;
             }
 
-            for (std::size_t i = 0; i < len; ++i)
-            {
-                dst[dst_pos] = dst[copy_src];
-                copy_src++;
-                dst_pos++;
-            }
-            
+            if(dist > dst_pos) return false;
+
+            len = std::min(len, out.size() - dst_pos);
+
+            CopyMatch(out.data() + dst_pos, dist, len, out.size() - dst_pos);
+            dst_pos += len;
+
         }
-        
+
         bits <<= 1;
         --count;
     }
 
-    dst_data->writeBytes(dst, decompressedSize);
+    state.mSrcPos = src_pos;
+    state.mBits = bits;
+    state.mBitCount = count;
+    outPos = dst_pos;
 
-    delete[] src;
-    delete[] dst;
+    return true;
 }
 
-_MatchResult findMatch(uint8_t* src, std::size_t readPtr, std::size_t matchMaxLength, std::size_t searchRange, std::size_t srcSize){
-    _MatchResult result = {0, 1};
+// Decodes from a checkpoint up to end in chunks of about chunkSize bytes, keeping only the
+// window a back reference can reach between chunks. onChunk gets the file position of each
+// decoded chunk, the chunk itself, and the state and window it ends on.
+template<typename ChunkCallback>
+static bool DecodeChunks(std::span<const uint8_t> src, const Checkpoint& start, std::size_t end, std::size_t chunkSize, ChunkCallback onChunk){
+    constexpr std::size_t WindowSize = sizeof(Checkpoint::mWindow);
+    constexpr std::size_t MaxMatch = 0x111;
 
-    if(readPtr + 2 < srcSize){
-        int matchPtr = readPtr - searchRange;
-        int windowEnd = readPtr + matchMaxLength;
+    std::vector<uint8_t> scratch(WindowSize + chunkSize + MaxMatch);
+    std::copy(start.mWindow.begin(), start.mWindow.end(), scratch.begin());
 
-        if(matchPtr < 0) matchPtr = 0;
-        if(windowEnd > srcSize) windowEnd = srcSize;
+    _DecoderState state { start.mSrcPos, start.mBits, start.mBitCount };
+    std::size_t chunkStart = start.mDstPos; // file position of scratch[WindowSize]
 
-        uint16_t v = *((uint16_t*)&src[readPtr]);
-        while(matchPtr < readPtr){
-            if(v != *((uint16_t*)&src[matchPtr])){
-                matchPtr++;
-                continue;
-            }
+    while(chunkStart < end){
+        std::size_t outPos = WindowSize;
+        std::size_t stop = WindowSize + std::min(chunkSize, end - chunkStart);
 
-            int matchWindowPtr = matchPtr + 1;
-            int srcWindowPtr = readPtr + 1;
+        if(!DecodeTokens(src, std::span<uint8_t>(scratch).first(WindowSize + std::min(chunkSize + MaxMatch, end - chunkStart)), outPos, stop, state)){
+            return false;
+        }
 
-            while(srcWindowPtr < windowEnd && src[srcWindowPtr] == src[matchWindowPtr]){
-                matchWindowPtr++;
-                srcWindowPtr++;
-            }
+        std::size_t decoded = outPos - WindowSize;
+        onChunk(chunkStart, std::span<const uint8_t>(scratch).subspan(WindowSize, decoded), state, scratch.data() + decoded);
+
+        std::memmove(scratch.data(), scratch.data() + decoded, WindowSize);
+        chunkStart += decoded;
+    }
 
-            int matchLength = srcWindowPtr - readPtr;
+    return true;
+}
 
-            if(result.length < matchLength){
-                result.length = matchLength;
-                result.position = matchPtr;
-                if(result.length == matchMaxLength){
-                    break;
-                }
-            }
+bool Decompress(std::span<const uint8_t> src, std::span<uint8_t> dst){
+    _DecoderState state;
+    std::size_t dst_pos = 0;
+    return DecodeTokens(src, dst, dst_pos, dst.size(), state);
+}
 
-            matchPtr++;
+bool Decompress(std::span<const uint8_t> src, std::span<uint8_t> dst, std::size_t offset, std::span<const Checkpoint> index){
+    std::size_t end = offset + dst.size();
+    if(end > GetDecompressedSize(src)) return false;
 
-        }
+    // Start from the last checkpoint at or before offset
+    auto checkpoint = std::upper_bound(index.begin(), index.end(), offset, [](std::size_t pos, const Checkpoint& c){ return pos < c.mDstPos; });
+
+    Checkpoint fileStart {};
+    const Checkpoint& start = checkpoint == index.begin() ? fileStart : *(checkpoint - 1);
+
+    if(start.mDstPos == 0 && offset == 0){
+        return Decompress(src, dst);
     }
 
-    return result;
+    return DecodeChunks(src, start, end, 0x10000, [&](std::size_t chunkStart, std::span<const uint8_t> chunk, const _DecoderState&, const uint8_t*){
+        std::size_t from = std::max(chunkStart, offset);
+        std::size_t to = std::min(chunkStart + chunk.size(), end);
+        if(from < to) std::copy(chunk.begin() + (from - chunkStart), chunk.begin() + (to - chunkStart), dst.begin() + (from - offset));
+    });
+}
+
+std::vector<Checkpoint> BuildIndex(std::span<const uint8_t> src, std::size_t interval){
+    std::vector<Checkpoint> index;
+    std::size_t decompressedSize = GetDecompressedSize(src);
+
+    Checkpoint fileStart {};
+    bool decoded = DecodeChunks(src, fileStart, decompressedSize, interval, [&](std::size_t chunkStart, std::span<const uint8_t> chunk, const _DecoderState& state, const uint8_t* window){
+        if(chunkStart + chunk.size() >= decompressedSize) return;
+
+        Checkpoint& checkpoint = index.emplace_back();
+        checkpoint.mSrcPos = state.mSrcPos;
+        checkpoint.mDstPos = chunkStart + chunk.size();
+        checkpoint.mBits = state.mBits;
+        checkpoint.mBitCount = state.mBitCount;
+        std::copy(window, window + checkpoint.mWindow.size(), checkpoint.mWindow.begin());
+    });
 
+    if(!decoded) index.clear();
+    return index;
 }
 
-void Compress(bStream::CStream* src_data, bStream::CStream* dst_data, uint8_t level){
-    uint8_t* src = new uint8_t[src_data->getSize()]{};
-    uint8_t* result = new uint8_t[src_data->getSize()]{};
+void Decompress(bStream::CStream* src_data, bStream::CStream* dst_data, uint32_t offset, uint32_t length){
+    std::size_t decompressedSize = GetDecompressedSize(src_data);
+
+    if(offset >= decompressedSize){
+        return;
+    }
+
+    if(length == 0 || length > decompressedSize - offset){
+        length = decompressedSize - offset;
+    }
+
+    std::vector<uint8_t> src(src_data->getSize());
+    std::vector<uint8_t> dst(length);
+
     src_data->seek(0);
-    src_data->readBytesTo(src, src_data->getSize());
+    src_data->readBytesTo(src.data(), src.size());
 
-    std::size_t searchRange = 0x10E0 * level / 9 - 0x0E0;
+    Decompress(src, dst, offset);
 
-    std::size_t readPtr = 0;
-    std::size_t writePtr = 0;
-    std::size_t codeBytePos = 0;
+    dst_data->writeBytes(dst.data(), dst.size());
+}
+
+// Tokens for one range of the source. Flags are kept apart from the token bytes so
+// ranges encoded on different threads can be packed into groups of 8 afterwards.
+struct _TokenRange {
+    std::vector<uint8_t> mFlags; // 1 for a literal, 0 for a back reference
+    std::vector<uint8_t> mData;
+};
+
+// Encodes [start, end), matches may look back into the 4 KB before start but never past end
+static void EncodeRange(uint8_t* src, std::size_t start, std::size_t end, const CompressOptions& options, _TokenRange& tokens){
+    _MatchFinder finder(src, end, options);
+
+    finder.mNextInsert = start > _MatchFinder::WindowSize ? start - _MatchFinder::WindowSize : 0;
+    finder.InsertUpTo(start);
+
+    std::size_t readPtr = start;
     std::size_t maxLength = 0x111;
 
-    while(readPtr < src_data->getSize()){
-        codeBytePos = writePtr++;
+    while(readPtr < end){
+        _MatchResult match = NextToken(finder, readPtr, maxLength, options);
 
-        for(int i = 0; i < 8; i++){
-            if(readPtr >= src_data->getSize()){
-                break;
+        std::size_t matchPosition = match.position;
+        std::size_t matchLength = match.length;
+
+        if(matchLength > 2){
+            std::size_t delta = readPtr - matchPosition - 1;
+
+            if(matchLength < 0x12) {
+                tokens.mData.push_back(delta >> 8 | (matchLength - 2) << 4);
+                tokens.mData.push_back(delta & 0xFF);
+            } else {
+                tokens.mData.push_back(delta >> 8);
+                tokens.mData.push_back(delta & 0xFF);
+                tokens.mData.push_back((matchLength - 0x12) & 0xFF);
             }
+            tokens.mFlags.push_back(0);
+            readPtr += matchLength;
+        } else {
+            tokens.mFlags.push_back(1);
+            tokens.mData.push_back(src[readPtr++]);
+        }
+    }
+}
 
-            std::size_t matchLength = 1;
-            std::size_t matchPosition = 0;
+void Compress(bStream::CStream* src_data, bStream::CStream* dst_data, uint8_t level){
+    Compress(src_data, dst_data, CompressOptions(level), 1);
+}
+
+void Compress(bStream::CStream* src_data, bStream::CStream* dst_data, uint8_t level, uint32_t threadCount){
+    Compress(src_data, dst_data, CompressOptions(level), threadCount);
+}
 
-            _MatchResult match = findMatch(src, readPtr, maxLength, searchRange, src_data->getSize());;
+void CompressStreaming(bStream::CStream* src_data, bStream::CStream* dst_data, uint8_t level){
+    CompressStreaming(src_data, dst_data, CompressOptions(level));
+}
 
-            matchPosition = match.position;
-            matchLength = match.length;
+// Body of both CompressStreaming overloads, read(dst, count) fills dst with the next count bytes of the source
+template<typename Reader>
+static void CompressStreamingFrom(Reader read, std::size_t srcSize, bStream::CStream* dst_data, const CompressOptions& options){
+    constexpr std::size_t WindowSize = _MatchFinder::WindowSize;
+    constexpr std::size_t BlockSize = 0x40000;
+    constexpr std::size_t MaxLength = 0x111;
+    constexpr std::size_t Lookahead = MaxLength + 2; // enough to hash every position a match covers
 
-            if(matchLength > 2){
-                std::size_t delta = readPtr - matchPosition - 1;
+    std::size_t srcRead = 0;
 
-                if(matchLength < 0x12) {
-                    result[writePtr++] = (delta >> 8 | (matchLength - 2) << 4);
-                    result[writePtr++] = (delta & 0xFF);
-                } else {
-                    result[writePtr++] = (delta >> 8);
-                    result[writePtr++] = (delta & 0xFF);
-                    result[writePtr++] = ((matchLength - 0x12) & 0xFF);
-                }
-                readPtr += matchLength;
+    std::vector<uint8_t> buffer(WindowSize * 2 + BlockSize + Lookahead);
+    std::size_t filled = 0;
+
+    auto refill = [&](){
+        std::size_t count = std::min(buffer.size() - filled, srcSize - srcRead);
+        read(buffer.data() + filled, count);
+        filled += count;
+        srcRead += count;
+    };
+    refill();
+
+    _MatchFinder finder(buffer.data(), filled, options);
+
+    std::size_t headerPos = dst_data->tell();
+    dst_data->writeString("Yaz0");
+    dst_data->writeUInt32(0);
+    dst_data->writeUInt32(0);
+    dst_data->writeUInt32(0);
+
+    // Tokens are grouped 8 to a code byte and written out in larger batches
+    std::vector<uint8_t> out;
+    std::size_t codeBytePos = 0;
+    std::size_t tokenCount = 0;
+
+    auto startToken = [&](bool literal){
+        if(tokenCount % 8 == 0){
+            if(out.size() >= BlockSize){
+                dst_data->writeBytes(out.data(), out.size());
+                out.clear();
+            }
+            codeBytePos = out.size();
+            out.push_back(0);
+        }
+        if(literal) out[codeBytePos] |= 1 << (7 - (tokenCount % 8));
+        tokenCount++;
+    };
+
+    std::size_t readPtr = 0;
+    while(readPtr < filled){
+        // Slide the buffer forward once the lookahead runs short, keeping the window behind readPtr
+        if(filled - readPtr < Lookahead && srcRead < srcSize && readPtr >= WindowSize * 2){
+            std::size_t shift = (readPtr - WindowSize) & ~(WindowSize - 1);
+            std::memmove(buffer.data(), buffer.data() + shift, filled - shift);
+            filled -= shift;
+            readPtr -= shift;
+            refill();
+
+            finder.mSrcSize = filled;
+            finder.Rebase(shift);
+        }
+
+        _MatchResult match = NextToken(finder, readPtr, MaxLength, options);
+
+        if(match.length > 2){
+            std::size_t delta = readPtr - match.position - 1;
+
+            startToken(false);
+            if(match.length < 0x12) {
+                out.push_back(delta >> 8 | (match.length - 2) << 4);
+                out.push_back(delta & 0xFF);
             } else {
-                result[codeBytePos] |= 1 << (7 - i);
-                result[writePtr++] = src[readPtr++];
+                out.push_back(delta >> 8);
+                out.push_back(delta & 0xFF);
+                out.push_back((match.length - 0x12) & 0xFF);
             }
+            readPtr += match.length;
+        } else {
+            startToken(true);
+            out.push_back(buffer[readPtr++]);
+        }
+    }
+
+    dst_data->writeBytes(out.data(), out.size());
 
+    std::size_t endPos = dst_data->tell();
+    dst_data->seek(headerPos + 4);
+    dst_data->writeUInt32(srcSize);
+    dst_data->seek(endPos);
+}
+
+void CompressStreaming(bStream::CStream* src_data, bStream::CStream* dst_data, const CompressOptions& options){
+    src_data->seek(0);
+    CompressStreamingFrom([src_data](uint8_t* dst, std::size_t count){ src_data->readBytesTo(dst, count); }, src_data->getSize(), dst_data, options);
+}
+
+void CompressStreaming(std::span<const std::span<const uint8_t>> src, bStream::CStream* dst_data, const CompressOptions& options){
+    std::size_t srcSize = 0;
+    for(auto piece : src) srcSize += piece.size();
+
+    std::size_t piece = 0, pieceOffset = 0;
+    auto read = [&](uint8_t* dst, std::size_t count){
+        while(count > 0){
+            std::size_t chunk = std::min(count, src[piece].size() - pieceOffset);
+            std::memcpy(dst, src[piece].data() + pieceOffset, chunk);
+            dst += chunk;
+            count -= chunk;
+            pieceOffset += chunk;
+
+            if(pieceOffset == src[piece].size()){
+                piece++;
+                pieceOffset = 0;
+            }
+        }
+    };
+
+    CompressStreamingFrom(read, srcSize, dst_data, options);
+}
+
+void Compress(bStream::CStream* src_data, bStream::CStream* dst_data, const CompressOptions& options, uint32_t threadCount){
+    std::size_t srcSize = src_data->getSize();
+    uint8_t* src = new uint8_t[srcSize]{};
+    src_data->seek(0);
+    src_data->readBytesTo(src, srcSize);
+
+    if(threadCount == 0) threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+    // Ranges only depend on the source size and thread count so output is deterministic
+    std::size_t rangeCount = std::clamp<std::size_t>(srcSize / MinRangeSize, 1, threadCount);
+    std::size_t rangeSize = srcSize / rangeCount;
+
+    std::shared_ptr<Cache> cache = GetCache();
+    uint64_t cacheKey = 0;
+    if(cache != nullptr){
+        std::vector<uint8_t> cached;
+        cacheKey = CacheKey(std::span<const uint8_t>(src, srcSize), Format::YAZ0, options, rangeCount);
+        if(cache->Get(cacheKey, cached) && GetDecompressedSize(cached) == srcSize){
+            dst_data->writeBytes(cached.data(), cached.size());
+            delete[] src;
+            return;
         }
+    }
+
+    std::vector<_TokenRange> ranges(rangeCount);
+    RunParallel(rangeCount, threadCount, [&](std::size_t r){
+        std::size_t end = r == rangeCount - 1 ? srcSize : (r + 1) * rangeSize;
+        EncodeRange(src, r * rangeSize, end, options, ranges[r]);
+    });
+
+    // Stitch the ranges together, every 8 tokens share a code byte
+    std::vector<uint8_t> result;
+    std::size_t codeBytePos = 0;
+    std::size_t tokenCount = 0;
+
+    for(auto& range : ranges){
+        std::size_t dataPtr = 0;
+        for(uint8_t flag : range.mFlags){
+            if(tokenCount % 8 == 0){
+                codeBytePos = result.size();
+                result.push_back(0);
+            }
+
+            std::size_t tokenLength = 1;
+            if(flag){
+                result[codeBytePos] |= 1 << (7 - (tokenCount % 8));
+            } else {
+                tokenLength = (range.mData[dataPtr] >> 4) == 0 ? 3 : 2;
+            }
 
+            result.insert(result.end(), range.mData.begin() + dataPtr, range.mData.begin() + dataPtr + tokenLength);
+            dataPtr += tokenLength;
+            tokenCount++;
+        }
     }
 
     dst_data->writeString("Yaz0");
-    dst_data->writeUInt32(src_data->getSize());
+    dst_data->writeUInt32(srcSize);
     dst_data->writeUInt32(0);
     dst_data->writeUInt32(0);
-    dst_data->writeBytes(result, writePtr);
+    dst_data->writeBytes(result.data(), result.size());
+
+    if(cache != nullptr){
+        cache->Put(cacheKey, CacheEntry("Yaz0", srcSize, 0, 0, { result }));
+    }
 
     delete[] src;
-    delete[] result;
 }
 
 }
@@ -194,115 +1092,115 @@ void Compress(bStream::CStream* src_data, bStream::CStream* dst_data, uint8_t le
 
 namespace Yay0 {
 
-void Decompress(bStream::CStream* src_data, bStream::CStream* dst_data, uint32_t offset, uint32_t length){
-    uint32_t expand_limit, bit_offset, expand_offset, ref_offset, read_offset, bit_count, bits;
+bool Decompress(std::span<const uint8_t> src, std::span<uint8_t> dst){
+    if(src.size() < 16) return false;
 
-    std::size_t decompressedSize = length;
-    uint8_t* src = new uint8_t[src_data->getSize()];
-    
-    if(length == 0){
-        src_data->seek(4);
-        decompressedSize = src_data->readUInt32(); 
-    }
-    
-    uint8_t* dst = new uint8_t[decompressedSize];
+    std::size_t ref_offset = ((src[8] << 24) | (src[9] << 16) | (src[10] << 8) | src[11]);
+    std::size_t read_offset = ((src[12] << 24) | (src[13] << 16) | (src[14] << 8) | src[15]);
+    std::size_t bit_offset = 16;
+    std::size_t dst_pos = 0;
 
-    src_data->seek(0);
-    src_data->readBytesTo(src, src_data->getSize());
-
-
-	expand_limit = ((src[4] << 24) | (src[5] << 16) | (src[6] << 8) | src[7]);
-	ref_offset = ((src[8] << 24) | (src[9] << 16) | (src[10] << 8) | src[11]);
-	read_offset = ((src[12] << 24) | (src[13] << 16) | (src[14] << 8) | src[15]);
-    
-    expand_offset = 0;
-    bit_count = 0;
-    bit_offset = 16;
-
-    if(decompressedSize == 0 || offset > expand_limit){
-        return;
-    }
-
-    uint8_t* read_dst = dst;
-    uint8_t* read_src = src + read_offset;
+    uint32_t bit_count = 0, bits = 0;
 
-    do {
+    while(dst_pos < dst.size()) {
         if(bit_count == 0){
-            uint8_t* data = (src + bit_offset);
-            bits = ((data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3]);
-        
+            if(bit_offset + 3 >= src.size()) return false;
+            bits = ((src[bit_offset] << 24) | (src[bit_offset + 1] << 16) | (src[bit_offset + 2] << 8) | src[bit_offset + 3]);
+
             bit_count = 32;
             bit_offset += 4;
         }
 
-        if(bits & 0x80000000) {
-            if(offset == 0){
-
-                *read_dst = *read_src;
+        // 8 literals in a row, only checked on mask byte boundaries
+        if((bit_count & 7) == 0 && (bits >> 24) == 0xFF && read_offset + 8 <= src.size() && dst_pos + 8 <= dst.size()){
+            std::memcpy(dst.data() + dst_pos, src.data() + read_offset, 8);
+            read_offset += 8;
+            dst_pos += 8;
+            bits <<= 8;
+            bit_count -= 8;
+            continue;
+        }
 
-                if(--length == 0){
-                    return;
-                }
-            } else {
-                --offset;
-            }
-            ++expand_offset;
-            ++read_dst;
-            ++read_offset;
-            ++read_src;
+        if(bits & 0x80000000) {
+            if(read_offset >= src.size()) return false;
+            dst[dst_pos++] = src[read_offset++];
         } else {
-            uint8_t* data = (src + ref_offset);
+            if(ref_offset + 1 >= src.size()) return false;
+            uint16_t run = (src[ref_offset] << 8 | src[ref_offset + 1]);
             ref_offset += 2;
 
-            uint16_t run = (data[0] << 8 | data[1]);
-            uint16_t run_length = (run >> 12);
-            uint16_t run_offset = (run & 0xFFF);
-            uint32_t ref_start = (expand_offset - run_offset);
-            uint32_t ref_length;
+            std::size_t ref_dist = (run & 0xFFF) + 1;
+            std::size_t ref_length = (run >> 12);
 
-            if(run_length == 0){
-                ref_length = (src[read_offset++] + 18);
-                ++read_src;
+            if(ref_length == 0){
+                if(read_offset >= src.size()) return false;
+                ref_length = src[read_offset++] + 18;
             } else {
-                ref_length = (run_length + 2);
+                ref_length += 2;
             }
 
-            if(ref_length > (expand_limit - expand_offset)){
-                ref_length = expand_limit - expand_offset;
-            }
+            if(ref_dist > dst_pos) return false;
 
-            uint8_t* ref_ptr = (dst + expand_offset);
-            while(ref_length > 0){
-                if(offset == 0){
-                    *ref_ptr = dst[ref_start - 1];
-                    if(--length == 0){
-                        return;
-                    }
-                } else {
-                    --offset;
-                }
+            ref_length = std::min(ref_length, dst.size() - dst_pos);
 
-                ++expand_offset;
-                ++read_dst;
-                ++ref_ptr;
-                ++ref_start;
-                --ref_length;
-            }
+            CopyMatch(dst.data() + dst_pos, ref_dist, ref_length, dst.size() - dst_pos);
+            dst_pos += ref_length;
         }
 
         bits <<= 1;
         --bit_count;
-    } while(expand_offset < expand_limit);
+    }
 
-    dst_data->writeBytes(dst, decompressedSize);
+    return true;
+}
 
-    delete[] src;
-    delete[] dst;
+void Decompress(bStream::CStream* src_data, bStream::CStream* dst_data, uint32_t offset, uint32_t length){
+    std::size_t decompressedSize = GetDecompressedSize(src_data);
+
+    if(offset >= decompressedSize){
+        return;
+    }
+
+    if(length == 0 || length > decompressedSize - offset){
+        length = decompressedSize - offset;
+    }
+
+    std::vector<uint8_t> src(src_data->getSize());
+    std::vector<uint8_t> dst(offset + length);
+
+    src_data->seek(0);
+    src_data->readBytesTo(src.data(), src.size());
+
+    Decompress(src, dst);
+
+    dst_data->writeBytes(dst.data() + offset, length);
+}
+
+void Compress(bStream::CStream*  src_data, bStream::CStream* dst_data, bool padCompressedFile, uint8_t level){
+    Compress(src_data, dst_data, padCompressedFile, Yaz0::CompressOptions(level));
 }
 
-// Adapted from Cuyler36's GCNToolkit.
-void Compress(bStream::CStream*  src_data, bStream::CStream* dst_data, bool padCompressedFile){
-    const uint32_t OFSBITS = 12;
+// Adapted from Cuyler36's GCNToolkit, matches are found with the same hash chains as Yaz0.
+void Compress(bStream::CStream*  src_data, bStream::CStream* dst_data, bool padCompressedFile, const Yaz0::CompressOptions& options){
+    uint8_t* src = new uint8_t[src_data->getSize()];
+    src_data->seek(0);
+    src_data->readBytesTo(src, src_data->getSize());
+
+    std::shared_ptr<Cache> cache = GetCache();
+    uint64_t cacheKey = 0;
+    if(cache != nullptr){
+        std::vector<uint8_t> cached;
+        cacheKey = CacheKey(std::span<const uint8_t>(src, src_data->getSize()), Format::YAY0, options, 0);
+        if(cache->Get(cacheKey, cached) && GetDecompressedSize(cached) == src_data->getSize()){
+            dst_data->writeBytes(cached.data(), cached.size());
+            if(padCompressedFile){
+                while(dst_data->tell() < Util::AlignTo(dst_data->getSize(), 0x20)) { dst_data->writeUInt8(0); }
+            }
+            delete[] src;
+            return;
+        }
+    }
+
     int32_t decPtr = 0;
     
     // Set up for mask buffer
@@ -312,54 +1210,25 @@ void Compress(bStream::CStream*  src_data, bStream::CStream* dst_data, bool padC
     
     // Set up for link buffer
     uint32_t linkMaxSize = src_data->getSize() >> 1;
-    uint16_t linkOffset = 0;
     int32_t linkPtr = 0;
     uint16_t minCount = 3, maxCount = 273;
 
-    // Set up chunk and window settings
-    int32_t chunkPtr = 0, windowPtr = 0, windowLen = 0, length = 0, maxlen = 0;
+    int32_t chunkPtr = 0, length = 0;
 
     // Initialize all the buffers with proper size
     uint32_t* maskBuffer = new uint32_t[maskMaxSize >> 2];
     uint16_t* linkBuffer = new uint16_t[linkMaxSize];
     uint8_t* chunkBuffer = new uint8_t[src_data->getSize()];
 
-    uint8_t* src = new uint8_t[src_data->getSize()];
-    src_data->seek(0);
-    src_data->readBytesTo(src, src_data->getSize());
+    _MatchFinder finder(src, src_data->getSize(), options);
 
     while(decPtr < src_data->getSize()){
-        if(windowLen >= 1 << OFSBITS){
-            windowLen -= (1 << OFSBITS);
-            windowPtr = decPtr - windowLen;
-        }
-
-        if(src_data->getSize() - decPtr < maxCount){
-            maxCount = (uint16_t)(src_data->getSize() - decPtr);
-        }
-
-        maxlen = 0;
-
-        for (std::size_t i = 0; i < windowLen; i++)
-        {
-            for (length = 0; length < (windowLen - i) && length < maxCount; length++)
-            {
-                if(src[decPtr + length] != src[windowPtr + length + i]) break;
-            }
-            if(length > maxlen)
-            {
-                maxlen = length;
-                linkOffset = (uint16_t)windowLen - i;
-
-            }
-            
-        }
-        
-        length = maxlen;
+        _MatchResult match = NextToken(finder, decPtr, maxCount, options);
+        length = match.length;
 
         mask <<= 1;
         if(length >= minCount){
-            uint16_t link = (uint16_t)((linkOffset - 1) & 0x0FFF);
+            uint16_t link = (uint16_t)((decPtr - match.position - 1) & 0x0FFF);
 
             if(length < 18){
                 link |= (uint16_t)((length - 2) << 12);
@@ -369,10 +1238,8 @@ void Compress(bStream::CStream*  src_data, bStream::CStream* dst_data, bool padC
 
             linkBuffer[linkPtr++] = bStream::swap16(link);
             decPtr += length;
-            windowLen += length;
         } else {
             chunkBuffer[chunkPtr++] = src[decPtr++];
-            windowLen++;
             mask |= 1;
         }
 
@@ -407,6 +1274,14 @@ void Compress(bStream::CStream*  src_data, bStream::CStream* dst_data, bool padC
     dst_data->seek(chunkSecOff);
     dst_data->writeBytes((uint8_t*)chunkBuffer, chunkPtr);
 
+    if(cache != nullptr){
+        cache->Put(cacheKey, CacheEntry(fourcc, src_data->getSize(), linkSecOff, chunkSecOff, {
+            std::span<const uint8_t>((uint8_t*)maskBuffer, maskPtr * sizeof(uint32_t)),
+            std::span<const uint8_t>((uint8_t*)linkBuffer, linkPtr * sizeof(uint16_t)),
+            std::span<const uint8_t>(chunkBuffer, chunkPtr)
+        }));
+    }
+
     if(padCompressedFile){
         while(dst_data->tell() < Util::AlignTo(dst_data->getSize(), 0x20)) { dst_data->writeUInt8(0); }
     }
@@ -420,4 +1295,187 @@ void Compress(bStream::CStream*  src_data, bStream::CStream* dst_data, bool padC
 
 }
 
+// Runs work(job) for every job on the shared workers
+static void RunJobs(std::span<Job> jobs, uint32_t threadCount, std::function<void(Job&)> work){
+    RunParallel(jobs.size(), threadCount, [&](std::size_t i){ work(jobs[i]); });
+}
+
+// Encodes all of src into dst as format, which has to be YAZ0 or YAY0
+static void CompressBuffer(std::span<const uint8_t> src, Format format, const Yaz0::CompressOptions& options, std::vector<uint8_t>& dst){
+    bStream::CMemoryStream srcStream(const_cast<uint8_t*>(src.data()), src.size(), bStream::Endianess::Big, bStream::OpenMode::In);
+    bStream::CMemoryStream dstStream(src.size() + 0x20, bStream::Endianess::Big, bStream::OpenMode::Out);
+
+    if(format == Format::YAZ0){
+        Yaz0::Compress(&srcStream, &dstStream, options);
+    } else {
+        Yay0::Compress(&srcStream, &dstStream, false, options);
+    }
+
+    dst.assign(dstStream.getBuffer(), dstStream.getBuffer() + dstStream.getSize());
+}
+
+void CompressMany(std::span<Job> jobs, uint32_t threadCount){
+    RunJobs(jobs, threadCount, [](Job& job){
+        if(job.mFormat == Format::None){
+            job.mResult.assign(job.mSrc.begin(), job.mSrc.end());
+        } else if(job.mFormat == Format::Auto){
+            CompressSmallest(job.mSrc, job.mResult, job.mOptions);
+        } else {
+            CompressBuffer(job.mSrc, job.mFormat, job.mOptions, job.mResult);
+        }
+        job.mSuccess = true;
+    });
+}
+
+void DecompressMany(std::span<Job> jobs, uint32_t threadCount){
+    RunJobs(jobs, threadCount, [](Job& job){
+        if(job.mFormat == Format::None){
+            job.mResult.assign(job.mSrc.begin(), job.mSrc.end());
+            job.mSuccess = true;
+            return;
+        }
+
+        if(job.mFormat == Format::Auto){
+            job.mSuccess = Decompress(job.mSrc, job.mResult);
+            return;
+        }
+
+        job.mResult.resize(GetDecompressedSize(job.mSrc));
+        job.mSuccess = job.mFormat == Format::YAZ0 ? Yaz0::Decompress(job.mSrc, job.mResult) : Yay0::Decompress(job.mSrc, job.mResult);
+    });
+}
+
+bool Decompress(std::span<const uint8_t> src, std::span<uint8_t> dst){
+    switch(Probe(src).mFormat){
+        case Format::YAZ0:
+            return Yaz0::Decompress(src, dst);
+        case Format::YAY0:
+            return Yay0::Decompress(src, dst);
+        default:
+            if(dst.size() > src.size()) return false;
+            std::copy(src.begin(), src.begin() + dst.size(), dst.begin());
+            return true;
+    }
+}
+
+bool Decompress(std::span<const uint8_t> src, std::vector<uint8_t>& dst){
+    dst.resize(Probe(src).mDecompressedSize);
+    return Decompress(src, std::span<uint8_t>(dst));
+}
+
+Format CompressSmallest(std::span<const uint8_t> src, std::vector<uint8_t>& dst, const Yaz0::CompressOptions& options, RaceReport* report){
+    std::vector<uint8_t> yaz0, yay0;
+    std::chrono::duration<double> yaz0Time, yay0Time;
+
+    auto encode = [&src, &options](Format format, std::vector<uint8_t>& out, std::chrono::duration<double>& time){
+        auto start = std::chrono::steady_clock::now();
+        CompressBuffer(src, format, options, out);
+        time = std::chrono::steady_clock::now() - start;
+    };
+
+    RunParallel(2, 2, [&](std::size_t i){
+        if(i == 0){
+            encode(Format::YAZ0, yaz0, yaz0Time);
+        } else {
+            encode(Format::YAY0, yay0, yay0Time);
+        }
+    });
+
+    Format winner = yay0.size() < yaz0.size() ? Format::YAY0 : Format::YAZ0;
+
+    if(report != nullptr){
+        report->mWinner = winner;
+        report->mYaz0Size = yaz0.size();
+        report->mYay0Size = yay0.size();
+        report->mYaz0Time = yaz0Time;
+        report->mYay0Time = yay0Time;
+    }
+
+    dst = std::move(winner == Format::YAY0 ? yay0 : yaz0);
+    return winner;
+}
+
+// Encodes [start, end) with the finder's settings and counts what the tokens would take up,
+// [historyStart, start) is hashed first so matches can reach back into it
+static void EstimateRange(_MatchFinder& finder, std::size_t historyStart, std::size_t start, std::size_t end, const Yaz0::CompressOptions& options, std::size_t& tokenBytes, std::size_t& tokenCount){
+    finder.mNextInsert = historyStart;
+    finder.InsertUpTo(start);
+
+    for(std::size_t pos = start; pos < end;){
+        // the finder needs room for a whole 3 byte prefix before end
+        _MatchResult match = end - pos >= 3 ? NextToken(finder, pos, std::min<std::size_t>(0x111, end - pos), options) : _MatchResult{0, 1};
+        std::size_t length = match.length > 2 ? match.length : 1;
+
+        tokenBytes += length >= 0x12 ? 3 : length >= 3 ? 2 : 1;
+        tokenCount++;
+        pos += length;
+    }
+}
+
+// Long prefix for the estimate's match finder. Few distinct bytes mean many positions in the window share
+// each prefix, the prefix is made long enough that about EstimateChainDepth of them do
+static std::size_t EstimatePrefix(std::span<const uint8_t> src){
+    std::array<std::size_t, 256> counts {};
+    std::size_t step = std::max<std::size_t>(src.size() / 0x1000, 1);
+    std::size_t total = 0;
+    for(std::size_t i = 0; i < src.size(); i += step){
+        counts[src[i]]++;
+        total++;
+    }
+
+    double entropy = 0;
+    for(std::size_t count : counts){
+        if(count == 0) continue;
+        double p = (double)count / total;
+        entropy -= p * std::log2(p);
+    }
+
+    double bits = std::log2((double)_MatchFinder::WindowSize / EstimateChainDepth);
+    return std::clamp<std::size_t>((std::size_t)std::ceil(bits / std::max(entropy, 0.5)), 4, 16);
+}
+
+std::size_t EstimateSize(std::span<const uint8_t> src, Format format, uint8_t level){
+    if(format == Format::None) return src.size();
+
+    Yaz0::CompressOptions options(level);
+    options.mMaxChainDepth = std::min(options.mMaxChainDepth, EstimateChainDepth);
+
+    // Inputs up to the budget are encoded whole, past it every sampled block is hashed along with its history
+    bool sampling = src.size() > EstimateSampleBudget;
+    std::size_t blockCount = EstimateSampleBudget / EstimateBlockSize;
+    std::size_t indexedSize = sampling ? std::min(src.size(), blockCount * (EstimateBlockSize + _MatchFinder::WindowSize)) : src.size();
+    uint32_t hashBits = std::clamp<uint32_t>(std::bit_width(indexedSize), 10, _MatchFinder::HashBits);
+
+    _MatchFinder finder(const_cast<uint8_t*>(src.data()), src.size(), options, EstimatePrefix(src), hashBits);
+    std::size_t tokenBytes = 0, tokenCount = 0;
+
+    if(!sampling){
+        EstimateRange(finder, 0, 0, src.size(), options, tokenBytes, tokenCount);
+    } else {
+        // A block from the middle of each stretch, with the 4 KB before it as history, scaled up to the whole input.
+        // The start of the input has no history and would weigh far more than it does in the real output
+        std::size_t stride = src.size() / blockCount;
+        std::size_t sampled = 0;
+
+        for(std::size_t block = 0; block < blockCount; block++){
+            std::size_t start = block * stride + (stride - EstimateBlockSize) / 2;
+            std::size_t end = std::min(start + EstimateBlockSize, src.size());
+            EstimateRange(finder, std::max(start > _MatchFinder::WindowSize ? start - _MatchFinder::WindowSize : 0, finder.mNextInsert), start, end, options, tokenBytes, tokenCount);
+            sampled += end - start;
+        }
+
+        tokenBytes = (std::size_t)((double)tokenBytes * src.size() / sampled);
+        tokenCount = (std::size_t)((double)tokenCount * src.size() / sampled);
+    }
+
+    std::size_t yaz0Size = 16 + tokenBytes + (tokenCount + 7) / 8;
+    std::size_t yay0Size = 16 + tokenBytes + (tokenCount + 31) / 32 * 4;
+
+    switch(format){
+        case Format::YAZ0: return yaz0Size;
+        case Format::YAY0: return yay0Size;
+        default: return std::min(yaz0Size, yay0Size);
+    }
+}
+
 }
\ No newline at end of file
@@ -15,49 +15,42 @@ Folder::Folder(std::shared_ptr<Image> disk){
     mParentDir = nullptr;
 }
 
-std::shared_ptr<File> Folder::GetFile(std::filesystem::path path) {
-    if(path.begin() == path.end()) return nullptr;
-
-
-    for(auto file : mFiles){
-        if(file->GetName() == path.begin()->string()){
-            if(((++path.begin()) == path.end())){
-                return file;
-            } /* else { // perhaps use this to mount rarc archives directly from isos?
-                if(file->MountAsArchive()){
-                    std::filesystem::path subPath;
-                    for(auto it = (++path.begin()); it != path.end(); it++) subPath  = subPath / it->string();
-                    return (*file)->GetFile(subPath);
-                }
-            }*/
-        }
+void Folder::SetName(std::string name){
+    mName = name;
+    if(mParentDir != nullptr){
+        mParentDir->mIndex.Invalidate();
     }
+}
 
-    std::shared_ptr<File> file = nullptr;
+std::shared_ptr<File> Folder::GetFile(std::string_view path) {
+    std::string_view name = Util::NextPathComponent(path);
+    if(name.empty()) return nullptr;
 
-    for(auto dir : mFolders){
-        if(dir->GetName() == path.begin()->string()){
-            std::filesystem::path subPath;
-            for(auto it = (++path.begin()); it != path.end(); it++) subPath  = subPath / it->string();
-            file = dir->GetFile(subPath);
+    Util::NameIndex<File, Folder>::Entry entry = mIndex.Find(name, mFiles, mFolders);
+
+    if(entry.mFile >= 0 && path.empty()){
+        return mFiles[entry.mFile];
+    } /* else { // perhaps use this to mount rarc archives directly from isos?
+        if(file->MountAsArchive()){
+            return (*file)->GetFile(path);
         }
+    }*/
+
+    if(entry.mFolder >= 0){
+        return mFolders[entry.mFolder]->GetFile(path);
     }
 
-    return file;
+    return nullptr;
 }
 
-std::shared_ptr<Folder> Folder::GetFolder(std::filesystem::path path){
-    for(auto dir : mFolders){
-        if(dir->GetName() == path.begin()->string() && ((++path.begin()) == path.end())){
-            return dir;
-        } else if(dir->GetName() == path.begin()->string()) {
-            std::filesystem::path subPath;
-            for(auto it = (++path.begin()); it != path.end(); it++) subPath  = subPath / it->string();
-            return dir->GetFolder(subPath);
-        }
-    }
+std::shared_ptr<Folder> Folder::GetFolder(std::string_view path){
+    std::string_view name = Util::NextPathComponent(path);
+    if(name.empty()) return nullptr;
 
-    return nullptr;
+    int32_t index = mIndex.Find(name, mFiles, mFolders).mFolder;
+    if(index < 0) return nullptr;
+
+    return path.empty() ? mFolders[index] : mFolders[index]->GetFolder(path);
 }
 
 std::shared_ptr<Folder> Folder::Copy(std::shared_ptr<Image> disk){
@@ -80,10 +73,22 @@ void Folder::AddSubdirectory(std::shared_ptr<Folder> dir){
     } else {
         dir->SetParentUnsafe(GetPtr());
         mFolders.push_back(dir);
+        mIndex.Invalidate();
     }
 }
 
 
+///
+/// File
+///
+
+void File::SetName(std::string name){
+    mName = name;
+    if(std::shared_ptr<Folder> parent = mParentDir.lock()){
+        parent->mIndex.Invalidate();
+    }
+}
+
 ///
 /// Disk
 ///
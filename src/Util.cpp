@@ -1,6 +1,19 @@
 #include <bstream.h>
+#include <bit>
+#include <cstring>
 #include "Util.hpp"
 
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace Util {
     uint32_t AlignTo(uint32_t x, uint32_t y){
         return ((x + (y-1)) & ~(y-1));
@@ -9,4 +22,109 @@ namespace Util {
     uint32_t PadTo32(uint32_t x){
         return ((x + (32-1)) & ~(32-1));
     }
+
+    // Single lane of xxHash64's round and finalizer, not compatible with it
+    uint64_t Hash(std::span<const uint8_t> data, uint64_t seed){
+        constexpr uint64_t Prime1 = 0x9E3779B185EBCA87ull;
+        constexpr uint64_t Prime2 = 0xC2B2AE3D27D4EB4Full;
+        constexpr uint64_t Prime3 = 0x165667B19E3779F9ull;
+
+        uint64_t hash = seed + Prime3 + data.size();
+
+        std::size_t i = 0;
+        for(; i + 8 <= data.size(); i += 8){
+            uint64_t word;
+            std::memcpy(&word, data.data() + i, 8);
+            hash ^= std::rotl(word * Prime2, 31) * Prime1;
+            hash = std::rotl(hash, 27) * Prime1 + Prime3;
+        }
+
+        for(; i < data.size(); i++){
+            hash ^= data[i] * Prime3;
+            hash = std::rotl(hash, 11) * Prime1;
+        }
+
+        hash ^= hash >> 33;
+        hash *= Prime2;
+        hash ^= hash >> 29;
+        hash *= Prime3;
+        hash ^= hash >> 32;
+
+        return hash;
+    }
+
+    std::string_view NextPathComponent(std::string_view& path){
+        auto isSeparator = [](char c){ return c == '/' || c == '\\'; };
+
+        std::size_t start = 0;
+        while(start < path.size() && isSeparator(path[start])) start++;
+
+        std::size_t end = start;
+        while(end < path.size() && !isSeparator(path[end])) end++;
+
+        std::string_view component = path.substr(start, end - start);
+
+        while(end < path.size() && isSeparator(path[end])) end++;
+        path.remove_prefix(end);
+
+        return component;
+    }
+
+    bool MappedFile::Open(std::filesystem::path path){
+        Close();
+
+#if defined(_WIN32)
+        HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if(file == INVALID_HANDLE_VALUE) return false;
+
+        LARGE_INTEGER size;
+        if(!GetFileSizeEx(file, &size) || size.QuadPart == 0){
+            CloseHandle(file);
+            return false;
+        }
+
+        HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+        CloseHandle(file);
+        if(mapping == nullptr) return false;
+
+        // the view keeps the mapping open
+        void* view = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+        CloseHandle(mapping);
+        if(view == nullptr) return false;
+
+        mData = static_cast<uint8_t*>(view);
+        mSize = static_cast<std::size_t>(size.QuadPart);
+#else
+        int file = open(path.c_str(), O_RDONLY);
+        if(file < 0) return false;
+
+        struct stat info;
+        if(fstat(file, &info) != 0 || info.st_size == 0){
+            close(file);
+            return false;
+        }
+
+        void* view = mmap(nullptr, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+        close(file);
+        if(view == MAP_FAILED) return false;
+
+        mData = static_cast<uint8_t*>(view);
+        mSize = static_cast<std::size_t>(info.st_size);
+#endif
+
+        return true;
+    }
+
+    void MappedFile::Close(){
+        if(mData == nullptr) return;
+
+#if defined(_WIN32)
+        UnmapViewOfFile(mData);
+#else
+        munmap(mData, mSize);
+#endif
+
+        mData = nullptr;
+        mSize = 0;
+    }
 }
\ No newline at end of file
@@ -0,0 +1,82 @@
+#include <Compression.hpp>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+// Checks Compression::EstimateSize against real Yaz0 output on the inputs its documented bound covers:
+// 2 to 6 symbol alphabets, text, text with zero runs and archive-like data from 2 KB to 1 MB, levels 1, 6 and 9.
+// Returns nonzero and prints every case outside the bound
+
+enum class Input { Alphabet2, Alphabet3, Alphabet4, Alphabet6, Text, TextZeroRuns, ArchiveLike };
+
+static std::vector<uint8_t> Generate(Input input, std::size_t size, std::mt19937& rng){
+    static const char* words[] = {
+        "the", "of", "and", "to", "in", "is", "archive", "file", "data", "compressed", "folder", "name", "size", "offset", "header",
+        "table", "string", "value", "with", "that", "for", "this", "from", "are", "each", "when", "which", "buffer", "stream", "level"
+    };
+
+    std::vector<uint8_t> data;
+    data.reserve(size);
+    while(data.size() < size){
+        switch(input){
+            case Input::Alphabet2: data.push_back('a' + rng() % 2); break;
+            case Input::Alphabet3: data.push_back('a' + rng() % 3); break;
+            case Input::Alphabet4: data.push_back('a' + rng() % 4); break;
+            case Input::Alphabet6: data.push_back('a' + rng() % 6); break;
+            case Input::Text:
+            case Input::TextZeroRuns:
+                for(const char* c = words[rng() % 30]; *c != '\0'; c++) data.push_back(*c);
+                data.push_back(rng() % 12 == 0 ? '\n' : ' ');
+                if(input == Input::TextZeroRuns && rng() % 40 == 0) data.insert(data.end(), 8 + rng() % 120, 0);
+                break;
+            case Input::ArchiveLike:
+                switch(rng() % 4){
+                    case 0:
+                        for(std::size_t i = 0, n = 16 + rng() % 64; i < n; i++) data.push_back(rng());
+                        break;
+                    case 1:
+                        data.insert(data.end(), 32 + rng() % 96, 0);
+                        break;
+                    default:
+                        if(data.size() < 0x1000) break;
+                        std::size_t distance = 1 + rng() % (rng() % 2 ? 0x40 : 0xFFF);
+                        for(std::size_t i = 0, n = 3 + rng() % 0x60; i < n; i++) data.push_back(data[data.size() - distance]);
+                        break;
+                }
+                break;
+        }
+    }
+    data.resize(size);
+    return data;
+}
+
+int main(){
+    const char* names[] = { "2 symbols", "3 symbols", "4 symbols", "6 symbols", "text", "text with zero runs", "archive-like" };
+    const double under = -0.03, over = 0.08;
+    int failures = 0;
+
+    for(int input = 0; input <= (int)Input::ArchiveLike; input++){
+        for(std::size_t size : { 0x800, 0x4000, 0x10000, 0x100000 }){
+            std::mt19937 rng(3 + input);
+            std::vector<uint8_t> data = Generate((Input)input, size, rng);
+
+            for(uint8_t level : { 1, 6, 9 }){
+                bStream::CMemoryStream src(data.data(), data.size(), bStream::Endianess::Big, bStream::OpenMode::In);
+                bStream::CMemoryStream dst(data.size() + 0x20, bStream::Endianess::Big, bStream::OpenMode::Out);
+                Compression::Yaz0::Compress(&src, &dst, level);
+
+                std::size_t real = dst.getSize();
+                std::size_t estimate = Compression::EstimateSize(data, Compression::Format::YAZ0, level);
+                double error = ((double)estimate - real) / real;
+
+                if(error < under || error > over){
+                    std::printf("%s, %zu bytes, level %d: estimated %zu, real %zu (%+.1f%%)\n", names[input], size, level, estimate, real, error * 100);
+                    failures++;
+                }
+            }
+        }
+    }
+
+    std::printf("%d estimates outside %+.0f%% to %+.0f%%\n", failures, under * 100, over * 100);
+    return failures == 0 ? 0 : 1;
+}